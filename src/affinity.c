@@ -0,0 +1,147 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "affinity.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int
+parse_cpu(const char** str, unsigned long* cpu)
+{
+    char* end;
+
+    errno = 0;
+    unsigned long res = strtoul(*str, &end, 10);
+    if (errno || (end == *str) || (res >= CPU_SETSIZE)) {
+        return -1;
+    }
+    *str = end;
+    *cpu = res;
+
+    return 0;
+}
+
+/* Parses a single CPU list, such as "0-3,6", up to the next colon or
+ * the end of the string. */
+static int
+parse_cpu_list(const char** str, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+
+    while (1) {
+        unsigned long first;
+        int res = parse_cpu(str, &first);
+        if (res < 0) {
+            return -1;
+        }
+
+        unsigned long last = first;
+        if (**str == '-') {
+            ++(*str);
+            res = parse_cpu(str, &last);
+            if ((res < 0) || (last < first)) {
+                return -1;
+            }
+        }
+
+        for (unsigned long cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, set);
+        }
+
+        if (**str != ',') {
+            return 0;
+        }
+        ++(*str);
+    }
+}
+
+int
+parse_cpu_sets(const char* str, cpu_set_t** sets, size_t* nsets)
+{
+    assert(str);
+    assert(sets);
+    assert(nsets);
+
+    size_t n = 1;
+    for (const char* pos = str; *pos; ++pos) {
+        if (*pos == ':') {
+            ++n;
+        }
+    }
+
+    cpu_set_t* set = malloc(n * sizeof(*set));
+    if (!set) {
+        perror("malloc");
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        int res = parse_cpu_list(&str, set + i);
+        if (res < 0) {
+            goto err_parse_cpu_list;
+        }
+        if (*str == ':') {
+            ++str;
+        } else if (*str) {
+            goto err_parse_cpu_list;
+        }
+    }
+
+    *sets = set;
+    *nsets = n;
+
+    return 0;
+
+err_parse_cpu_list:
+    free(set);
+    return -1;
+}
+
+int
+init_thread_attr(pthread_attr_t* attr, const cpu_set_t* cpus)
+{
+    assert(attr);
+
+    int err = pthread_attr_init(attr);
+    if (err) {
+        errno = err;
+        perror("pthread_attr_init");
+        return -1;
+    }
+
+    if (!cpus) {
+        return 0;
+    }
+
+    err = pthread_attr_setaffinity_np(attr, sizeof(*cpus), cpus);
+    if (err) {
+        errno = err;
+        perror("pthread_attr_setaffinity_np");
+        goto err_pthread_attr_setaffinity_np;
+    }
+
+    return 0;
+
+err_pthread_attr_setaffinity_np:
+    pthread_attr_destroy(attr);
+    return -1;
+}
@@ -0,0 +1,46 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+
+/* Parses a colon-separated list of CPU sets, such as "0:1:2-3,6". The
+ * i-th thread of a group runs on the set at index i modulo the number
+ * of sets. On success, the returned array has to be released with
+ * free(). Returns -1 if the string is malformed.
+ */
+int
+parse_cpu_sets(const char* str, cpu_set_t** sets, size_t* nsets);
+
+/* Returns the CPU set for the i-th thread of a group, or NULL if no
+ * CPU sets have been given. */
+static inline const cpu_set_t*
+cpu_set_of_thread(const cpu_set_t* sets, size_t nsets, size_t i)
+{
+    return nsets ? sets + (i % nsets) : NULL;
+}
+
+/* Creates thread attributes that pin a thread to `cpus`. If `cpus` is
+ * NULL, the thread runs on any CPU. */
+int
+init_thread_attr(pthread_attr_t* attr, const cpu_set_t* cpus);
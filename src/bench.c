@@ -0,0 +1,249 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "bench.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "clock.h"
+#include "hist.h"
+#include "in.h"
+#include "proc.h"
+#include "ptr.h"
+#include "txstats.h"
+
+/* Interval for checking the end conditions */
+static const long POLL_INTERVAL_NSECS = 10000000;
+
+struct bench_totals {
+    unsigned long nread;
+    unsigned long nbytes;
+    unsigned long in_ncommits;
+    unsigned long in_naborts;
+    unsigned long ndropped;
+    unsigned long ncoalesced;
+    unsigned long napplied;
+    unsigned long nstolen;
+    unsigned long proc_ncommits;
+    unsigned long proc_naborts;
+    bool in_done;
+};
+
+static void
+sum_up_stats(struct bench_totals* totals,
+             const struct in_stats* in_stats, size_t nin_threads,
+             const struct proc_stats* proc_stats, size_t nproc_threads)
+{
+    *totals = (struct bench_totals){
+        .in_done = true
+    };
+
+    const struct in_stats* in_beg = in_stats;
+    const struct in_stats* in_end = in_stats + nin_threads;
+
+    for (const struct in_stats* st = in_beg; st < in_end; ++st) {
+        totals->nread += atomic_load_explicit(&st->nmsgs,
+                                              memory_order_relaxed);
+        totals->nbytes += atomic_load_explicit(&st->nbytes,
+                                               memory_order_relaxed);
+        totals->in_ncommits += atomic_load_explicit(&st->ncommits,
+                                                    memory_order_relaxed);
+        totals->in_naborts += atomic_load_explicit(&st->naborts,
+                                                   memory_order_relaxed);
+        totals->ndropped += atomic_load_explicit(&st->ndropped,
+                                                 memory_order_relaxed);
+        totals->ncoalesced += atomic_load_explicit(&st->ncoalesced,
+                                                   memory_order_relaxed);
+        totals->in_done &= atomic_load_explicit(&st->done,
+                                                memory_order_acquire);
+    }
+
+    const struct proc_stats* proc_beg = proc_stats;
+    const struct proc_stats* proc_end = proc_stats + nproc_threads;
+
+    for (const struct proc_stats* st = proc_beg; st < proc_end; ++st) {
+        totals->napplied += atomic_load_explicit(&st->nentries,
+                                                 memory_order_relaxed);
+        totals->nstolen += atomic_load_explicit(&st->nstolen,
+                                                memory_order_relaxed);
+        totals->proc_ncommits += atomic_load_explicit(&st->ncommits,
+                                                      memory_order_relaxed);
+        totals->proc_naborts += atomic_load_explicit(&st->naborts,
+                                                     memory_order_relaxed);
+    }
+}
+
+static bool
+has_failed(const struct bench_config* config)
+{
+    return config->failed &&
+           atomic_load_explicit(config->failed, memory_order_acquire);
+}
+
+static bool
+is_finished(const struct bench_config* config,
+            const struct bench_totals* totals, unsigned long long nsecs)
+{
+    if (has_failed(config)) {
+        return true;
+    }
+    if (config->duration_secs &&
+        (nsecs >= config->duration_secs * 1000000000ull)) {
+        return true;
+    }
+    if (config->nmsgs && (totals->napplied >= config->nmsgs)) {
+        return true;
+    }
+    /* All input has been read and applied; except for messages that
+     * full queues dropped or coalesced. */
+    return totals->in_done &&
+           ((totals->napplied + totals->ndropped + totals->ncoalesced) >=
+            totals->nread);
+}
+
+static const double percentile[] = {
+    50, 90, 99, 99.9
+};
+
+static void
+print_percentiles(FILE* stream, const struct hist* hist)
+{
+    for (size_t j = 0; j < arraylen(percentile); ++j) {
+        fprintf(stream, " p%g=%.1f", percentile[j],
+                hist_percentile(hist, percentile[j]) / 1e3);
+    }
+    fprintf(stream, " max=%.1f\n", hist_max(hist) / 1e3);
+}
+
+int
+print_latencies(FILE* stream, const struct proc_stats* proc_stats,
+                size_t nproc_threads, bool priorities)
+{
+    struct hist* hist = malloc(sizeof(*hist));
+    if (!hist) {
+        perror("malloc");
+        return -1;
+    }
+
+    fprintf(stream, "Latency (usecs):\n");
+
+    for (int i = 0; i < NLATENCIES; ++i) {
+
+        hist_init(hist);
+        proc_stats_merge_latency(proc_stats, nproc_threads, i, hist);
+
+        fprintf(stream, "  %-16s", proc_latency_name(i));
+        print_percentiles(stream, hist);
+    }
+
+    /* Only break down end-to-end latencies of priority queues, and
+     * only if messages of more than one priority have been applied. */
+    unsigned int npriorities = 0;
+
+    for (unsigned int i = 0; priorities && (i < NPRIORITIES); ++i) {
+        hist_init(hist);
+        proc_stats_merge_priority_latency(proc_stats, nproc_threads, i, hist);
+        npriorities += !!hist_count(hist);
+    }
+
+    for (unsigned int i = 0; (npriorities > 1) && (i < NPRIORITIES); ++i) {
+
+        hist_init(hist);
+        proc_stats_merge_priority_latency(proc_stats, nproc_threads, i, hist);
+        if (!hist_count(hist)) {
+            continue;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "priority %u", i);
+
+        fprintf(stream, "  %-16s", name);
+        print_percentiles(stream, hist);
+    }
+
+    free(hist);
+
+    return 0;
+}
+
+static void
+print_report(const struct bench_totals* totals, unsigned long long nsecs)
+{
+    double secs = nsecs / 1e9;
+
+    printf("Run time:           %.3f s\n", secs);
+    printf("Messages read:      %lu (%.0f msgs/s, %.2f MiB/s)\n",
+           totals->nread, totals->nread / secs,
+           totals->nbytes / secs / (1024 * 1024));
+    printf("Messages applied:   %lu (%.0f msgs/s)\n",
+           totals->napplied, totals->napplied / secs);
+    printf("Messages stolen:    %lu\n", totals->nstolen);
+    printf("Messages dropped:   %lu (%lu coalesced)\n",
+           totals->ndropped + totals->ncoalesced, totals->ncoalesced);
+    printf("Input commits:      %lu (%lu aborts)\n",
+           totals->in_ncommits, totals->in_naborts);
+    printf("Processing commits: %lu (%lu aborts)\n",
+           totals->proc_ncommits, totals->proc_naborts);
+}
+
+int
+bench_main(const struct bench_config* config,
+           const struct in_stats* in_stats, size_t nin_threads,
+           const struct proc_stats* proc_stats, size_t nproc_threads)
+{
+    assert(config);
+
+    unsigned long long beg = monotonic_nsecs();
+    unsigned long long nsecs;
+
+    struct bench_totals totals;
+
+    do {
+        static const struct timespec interval = {
+            .tv_sec = 0,
+            .tv_nsec = POLL_INTERVAL_NSECS
+        };
+        nanosleep(&interval, NULL);
+
+        sum_up_stats(&totals, in_stats, nin_threads,
+                     proc_stats, nproc_threads);
+        nsecs = monotonic_nsecs() - beg;
+
+    } while (!is_finished(config, &totals, nsecs));
+
+    print_report(&totals, nsecs);
+
+    int res = print_latencies(stdout, proc_stats, nproc_threads,
+                              config->priorities);
+    if (res < 0) {
+        return -1;
+    }
+
+    print_tx_stats(stdout);
+
+    if (has_failed(config)) {
+        fprintf(stderr, "A processing thread failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
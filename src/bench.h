@@ -0,0 +1,62 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct in_stats;
+struct proc_stats;
+
+struct bench_config {
+    /* run time in seconds, or 0 for no limit */
+    unsigned long duration_secs;
+    /* number of messages to apply, or 0 for no limit */
+    unsigned long nmsgs;
+    /* break down latencies by priority */
+    bool priorities;
+    /* if not NULL, set when a processing thread failed */
+    const atomic_bool* failed;
+};
+
+/* Prints percentiles of the processing threads' latencies to
+ * `stream`. With `priorities` set and messages of different priorities
+ * applied, also prints the end-to-end latency of each priority.
+ * Returns 0 on success, or -1 on errors. */
+int
+print_latencies(FILE* stream, const struct proc_stats* proc_stats,
+                size_t nproc_threads, bool priorities);
+
+/* Runs the pipeline without UI until the configured run time passed,
+ * the configured number of messages has been applied, all input
+ * threads reached the end of their input, or a processing thread
+ * failed. Prints throughput, commit
+ * and abort counts, latency percentiles and per-site transaction
+ * statistics to stdout. The arrays
+ * `in_stats` and `proc_stats` contain one element per thread. Returns
+ * 0 on success, or -1 on errors.
+ */
+int
+bench_main(const struct bench_config* config,
+           const struct in_stats* in_stats, size_t nin_threads,
+           const struct proc_stats* proc_stats, size_t nproc_threads);
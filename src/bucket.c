@@ -0,0 +1,128 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "bucket.h"
+#include <assert.h>
+#include "clock.h"
+
+/* Waits shorter than this spin instead of sleeping. Sleeps end up to
+ * the timer slack late, which is 50 microseconds by default. */
+static const unsigned long long SPIN_NSECS = 100000;
+
+static unsigned long long
+max_tokens(const struct token_bucket* self)
+{
+    return self->burst * 1000000000ull;
+}
+
+static void
+refill(struct token_bucket* self, unsigned long long now)
+{
+    unsigned long long elapsed = now - self->last_nsecs;
+    self->last_nsecs = now;
+
+    /* Don't overflow on long pauses. */
+    unsigned long long missing = max_tokens(self) - self->ntokens;
+    if (elapsed >= missing / self->rate) {
+        self->ntokens = max_tokens(self);
+        return;
+    }
+
+    self->ntokens += elapsed * self->rate;
+}
+
+void
+token_bucket_init(struct token_bucket* self, unsigned long rate,
+                  size_t burst)
+{
+    assert(self);
+    assert(rate);
+    assert(burst);
+
+    self->rate = rate;
+    self->burst = burst;
+    self->ntokens = max_tokens(self);
+    self->last_nsecs = monotonic_nsecs();
+}
+
+/* Returns the time at which `n` tokens are available, or `now` if
+ * they are available already. */
+static unsigned long long
+due_nsecs(struct token_bucket* self, size_t n, unsigned long long now)
+{
+    const unsigned long long needed = n * 1000000000ull;
+
+    refill(self, now);
+
+    if (self->ntokens >= needed) {
+        return now;
+    }
+    return now + (needed - self->ntokens + self->rate - 1) / self->rate;
+}
+
+unsigned long long
+token_bucket_wake_nsecs(struct token_bucket* self, size_t n)
+{
+    assert(self);
+    assert(n <= self->burst);
+
+    unsigned long long now = monotonic_nsecs();
+    unsigned long long due = due_nsecs(self, n, now);
+
+    if (due - now <= SPIN_NSECS) {
+        return now;
+    }
+    return due - SPIN_NSECS;
+}
+
+void
+token_bucket_take(struct token_bucket* self, size_t n)
+{
+    assert(self);
+    assert(n <= self->burst);
+
+    unsigned long long now = monotonic_nsecs();
+    unsigned long long due = due_nsecs(self, n, now);
+
+    if (due > now) {
+
+        if (due - now > SPIN_NSECS) {
+            sleep_until(due - SPIN_NSECS);
+        }
+        do {
+            now = monotonic_nsecs();
+        } while (now < due);
+
+        refill(self, now);
+    }
+
+    self->ntokens -= n * 1000000000ull;
+}
+
+void
+token_bucket_put(struct token_bucket* self, size_t n)
+{
+    assert(self);
+
+    self->ntokens += n * 1000000000ull;
+    if (self->ntokens > max_tokens(self)) {
+        self->ntokens = max_tokens(self);
+    }
+}
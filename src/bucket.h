@@ -0,0 +1,59 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* A token bucket that limits the rate of messages
+ *
+ * Tokens accumulate at `rate` per second, up to `burst` tokens. Taking
+ * tokens waits until enough of them are available. Long waits sleep;
+ * the last part of a wait spins, so that the rate is also met for
+ * intervals shorter than the timer slack.
+ */
+struct token_bucket {
+    unsigned long rate;
+    size_t burst;
+
+    /* available tokens, scaled by 10^9 */
+    unsigned long long ntokens;
+    unsigned long long last_nsecs;
+};
+
+/* Initializes a full bucket. */
+void
+token_bucket_init(struct token_bucket* self, unsigned long rate,
+                  size_t burst);
+
+/* Returns the time of the monotonic clock until which callers can
+ * sleep before they take `n` tokens. Callers that have to check other
+ * conditions while they wait sleep in slices until then. */
+unsigned long long
+token_bucket_wake_nsecs(struct token_bucket* self, size_t n);
+
+/* Waits until `n` tokens are available and takes them. `n` must not
+ * exceed the bucket's burst size. */
+void
+token_bucket_take(struct token_bucket* self, size_t n);
+
+/* Returns `n` unused tokens to the bucket. */
+void
+token_bucket_put(struct token_bucket* self, size_t n);
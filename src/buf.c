@@ -20,7 +20,17 @@
 
 #include "buf.h"
 #include <assert.h>
+#include <picotm/picotm-tm.h>
+#include <picotm/picotm-tm-ctypes.h>
+#include <picotm/string.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "ptr.h"
+#include "sum.h"
 
 void
 data_buf_init(struct data_buf* self)
@@ -33,4 +43,218 @@ data_buf_init(struct data_buf* self)
     for (; beg < end; ++beg) {
         memset(beg, 0, 256);
     }
+
+    memset(self->row_len, 0, sizeof(self->row_len));
+    memset(self->row_sum, 0, sizeof(self->row_sum));
+    memset(self->sum_tree, 0, sizeof(self->sum_tree));
+
+    atomic_init(&self->wbegin, 0);
+    atomic_init(&self->wend, 0);
+}
+
+void
+data_buf_restore(struct data_buf* self)
+{
+    assert(self);
+
+    for (size_t row = 0; row < arraylen(self->field); ++row) {
+        const uint8_t* field = self->field[row];
+
+        /* Trailing bytes that are 0 don't need to be cleared by the
+         * next write, so they don't count as written. */
+        size_t len = sizeof(self->field[row]);
+        while (len && !field[len - 1]) {
+            --len;
+        }
+
+        self->row_len[row] = len;
+        self->row_sum[row] = bytes_sum(field, len);
+    }
+
+    /* Build the Fenwick tree in place: each entry passes its partial
+     * sum on to its parent. */
+    memcpy(self->sum_tree, self->row_sum, sizeof(self->sum_tree));
+
+    for (size_t i = 0; i < arraylen(self->sum_tree); ++i) {
+        size_t parent = i | (i + 1);
+        if (parent < arraylen(self->sum_tree)) {
+            self->sum_tree[parent] += self->sum_tree[i];
+        }
+    }
+
+    atomic_init(&self->wbegin, 0);
+    atomic_init(&self->wend, 0);
+}
+
+int
+data_buf_sync(struct data_buf* self)
+{
+    assert(self);
+
+    /* msync() requires a page-aligned address. */
+    uintptr_t pagemask = sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t beg = (uintptr_t)self & ~pagemask;
+    uintptr_t end = (uintptr_t)(self + 1);
+
+    int res = msync((void*)beg, end - beg, MS_SYNC);
+    if (res < 0) {
+        perror("msync");
+        return -1;
+    }
+    return 0;
+}
+
+void
+data_buf_begin_write(struct data_buf* self)
+{
+    assert(self);
+
+    atomic_fetch_add_explicit(&self->wbegin, 1, memory_order_relaxed);
+
+    /* Readers that see the transaction's writes also see the
+     * incremented counter. */
+    atomic_thread_fence(memory_order_release);
+}
+
+void
+data_buf_end_write(struct data_buf* self)
+{
+    assert(self);
+
+    atomic_fetch_add_explicit(&self->wend, 1, memory_order_release);
+}
+
+/* Copies `len` bytes of the buffer at `src` to `dst` until no writer
+ * interfered with the copy. */
+static void
+read_consistent(struct data_buf* self, void* dst, const void* src,
+                size_t len)
+{
+    for (unsigned long i = 0;; ++i) {
+
+        unsigned long wbegin = atomic_load_explicit(&self->wbegin,
+                                                    memory_order_acquire);
+        unsigned long wend = atomic_load_explicit(&self->wend,
+                                                  memory_order_acquire);
+        if (wbegin == wend) {
+
+            memcpy(dst, src, len);
+
+            atomic_thread_fence(memory_order_acquire);
+
+            if (atomic_load_explicit(&self->wbegin,
+                                     memory_order_relaxed) == wbegin) {
+                return;
+            }
+        }
+
+        /* Writers are active. Let them run if we failed repeatedly. */
+        if (!((i + 1) % 64)) {
+            sched_yield();
+        }
+    }
+}
+
+void
+data_buf_snapshot(struct data_buf* self, struct data_buf_snapshot* snap)
+{
+    assert(self);
+    assert(snap);
+
+    static_assert(sizeof(snap->row_len) == sizeof(self->row_len),
+                  "snapshot and buffer differ in size");
+    static_assert(sizeof(snap->row_sum) == sizeof(self->row_sum),
+                  "snapshot and buffer differ in size");
+    static_assert(sizeof(snap->sum_tree) == sizeof(self->sum_tree),
+                  "snapshot and buffer differ in size");
+    static_assert(offsetof(struct data_buf, sum_tree) -
+                  offsetof(struct data_buf, row_len) ==
+                  offsetof(struct data_buf_snapshot, sum_tree),
+                  "snapshot and buffer differ in layout");
+
+    /* The row lengths, row sums and the sum tree are adjacent in the
+     * buffer, so a single copy takes them all. */
+    read_consistent(self, snap, self->row_len, sizeof(*snap));
+}
+
+void
+data_buf_snapshot_row(struct data_buf* self, size_t row,
+                      uint8_t row_buf[256])
+{
+    assert(self);
+    assert(row < arraylen(self->field));
+
+    read_consistent(self, row_buf, self->field[row],
+                    sizeof(self->field[row]));
+}
+
+static unsigned int
+bytes_sum_tx(const uint8_t* data, size_t len)
+{
+    privatize_tx(data, len, PICOTM_TM_PRIVATIZE_LOAD);
+
+    return bytes_sum(data, len);
+}
+
+/* Adds `delta` to the row's entries in the Fenwick tree. Negative
+ * deltas wrap around, which cancels out in the final sums. */
+static void
+sum_tree_add_tx(struct data_buf* self, size_t row, unsigned int delta)
+{
+    for (size_t i = row; i < arraylen(self->sum_tree); i |= i + 1) {
+        store_uint_tx(self->sum_tree + i,
+                      load_uint_tx(self->sum_tree + i) + delta);
+    }
+}
+
+/* Returns the sum of the rows [0, end) from a snapshot's sum tree. */
+static unsigned long
+sum_tree_prefix(const struct data_buf_snapshot* snap, size_t end)
+{
+    unsigned long sum = 0;
+
+    for (size_t i = end; i; i &= i - 1) {
+        sum += snap->sum_tree[i - 1];
+    }
+
+    return sum;
+}
+
+void
+data_buf_write_row_tx(struct data_buf* self, size_t row,
+                      const uint8_t* data, size_t len)
+{
+    assert(row < arraylen(self->field));
+    assert(len <= sizeof(self->field[row]));
+
+    uint8_t* field = self->field[row];
+    memcpy_tx(field, data, len);
+
+    unsigned int old_len = load_uint_tx(self->row_len + row);
+    if (old_len > len) {
+        memset_tx(field + len, 0, old_len - len);
+    }
+    if (old_len != len) {
+        store_uint_tx(self->row_len + row, len);
+    }
+
+    unsigned int sum = bytes_sum_tx(data, len);
+    unsigned int old_sum = load_uint_tx(self->row_sum + row);
+    if (sum == old_sum) {
+        return;
+    }
+
+    store_uint_tx(self->row_sum + row, sum);
+    sum_tree_add_tx(self, row, sum - old_sum);
+}
+
+unsigned long
+data_buf_snapshot_range_sum(const struct data_buf_snapshot* snap,
+                            size_t beg, size_t end)
+{
+    assert(snap);
+    assert(beg <= end);
+    assert(end <= arraylen(snap->sum_tree));
+
+    return sum_tree_prefix(snap, end) - sum_tree_prefix(snap, beg);
 }
@@ -20,11 +20,86 @@
 
 #pragma once
 
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 
 struct data_buf {
     uint8_t field[256][256];
+
+    /* The number of bytes written to each row; the remaining bytes of
+     * the row are 0. */
+    unsigned int row_len[256];
+
+    /* The sum of each row's bytes */
+    unsigned int row_sum[256];
+
+    /* A Fenwick tree over the row sums. The tree answers range sums
+     * over rows in O(log n) and is updated together with the rows. */
+    unsigned int sum_tree[256];
+
+    /* Writers increment `wbegin` before their transaction and `wend`
+     * after it. Readers take snapshots like with a seqlock: the
+     * snapshot is consistent if no writer was active and none started
+     * while the reader copied the data. */
+    atomic_ulong wbegin;
+    atomic_ulong wend;
+};
+
+/* A consistent copy of a buffer's row lengths and sums */
+struct data_buf_snapshot {
+    unsigned int row_len[256];
+    unsigned int row_sum[256];
+    unsigned int sum_tree[256];
 };
 
 void
 data_buf_init(struct data_buf* self);
+
+/* Prepares a buffer from a previous run for use. The row lengths and
+ * sums are recomputed from the rows, as the previous run might have
+ * stopped in the middle of a transaction. */
+void
+data_buf_restore(struct data_buf* self);
+
+/* Flushes the buffer to its backing file. Returns 0 on success, or -1
+ * on errors. */
+int
+data_buf_sync(struct data_buf* self);
+
+/* Brackets a transaction that writes to the buffer. The writer calls
+ * `data_buf_begin_write()` before the transaction's first write to the
+ * buffer, and at most once if the transaction restarts. It calls
+ * `data_buf_end_write()` after the transaction; also if it failed.
+ * Writers never wait for readers. */
+void
+data_buf_begin_write(struct data_buf* self);
+
+void
+data_buf_end_write(struct data_buf* self);
+
+/* Takes a snapshot of the buffer's row lengths and sums without
+ * running a transaction. Readers retry until no writer interfered, so
+ * they never cause writer transactions to abort. */
+void
+data_buf_snapshot(struct data_buf* self, struct data_buf_snapshot* snap);
+
+/* Copies a consistent snapshot of a row into `row_buf`. */
+void
+data_buf_snapshot_row(struct data_buf* self, size_t row,
+                      uint8_t row_buf[256]);
+
+/* Returns the sum of all bytes in the rows [beg, end) of a snapshot. */
+unsigned long
+data_buf_snapshot_range_sum(const struct data_buf_snapshot* snap,
+                            size_t beg, size_t end);
+
+/* Copies `len` bytes into the row and fills the remaining bytes of the
+ * row with 0. Only bytes that held data before are cleared, so the
+ * transaction's write set grows with the written bytes instead of the
+ * row size. Updates the row's sum and the range-sum index within the
+ * same transaction. */
+void
+data_buf_write_row_tx(struct data_buf* self, size_t row,
+                      const uint8_t* data, size_t len);
+
@@ -22,9 +22,28 @@
 
 #include <stdint.h>
 
+/* The upper bits of a message's queue field carry the message's
+ * priority; the lower bits select the queue. Priority 0 is the most
+ * urgent. */
+#define MSG_PRIORITY_BITS   2
+#define MSG_QUEUE_BITS      (16 - MSG_PRIORITY_BITS)
+#define NPRIORITIES         (1u << MSG_PRIORITY_BITS)
+
 struct hdr {
     uint16_t queue;
     uint8_t off;
     uint8_t len;
     uint8_t buf[256];
 };
+
+static inline unsigned int
+msg_queue(uint16_t queue)
+{
+    return queue & ((1u << MSG_QUEUE_BITS) - 1);
+}
+
+static inline unsigned int
+msg_priority(uint16_t queue)
+{
+    return queue >> MSG_QUEUE_BITS;
+}
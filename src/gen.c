@@ -0,0 +1,414 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "gen.h"
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data.h"
+
+void
+gen_config_init(struct gen_config* self)
+{
+    assert(self);
+
+    self->queue.dist = GEN_KEY_UNIFORM;
+    self->row.dist = GEN_KEY_UNIFORM;
+    self->priorities = false;
+    self->prio.dist = GEN_KEY_UNIFORM;
+    self->len.dist = GEN_LEN_UNIFORM;
+    self->len.a = 0;
+    self->len.b = 255;
+    self->rate = 0;
+    self->seed = 1;
+}
+
+static int
+parse_key(struct gen_key_config* key, const char* str)
+{
+    int n = -1;
+
+    if (!strcmp(str, "uniform")) {
+        key->dist = GEN_KEY_UNIFORM;
+        return 0;
+    }
+
+    if ((sscanf(str, "zipf:%lf%n", &key->s, &n) == 1) && !str[n] &&
+        (key->s > 0)) {
+        key->dist = GEN_KEY_ZIPF;
+        return 0;
+    }
+
+    n = -1;
+    if ((sscanf(str, "hot:%lf:%lf%n", &key->frac, &key->prob, &n) == 2) &&
+        !str[n] && (key->frac > 0) && (key->frac <= 1) &&
+        (key->prob >= 0) && (key->prob <= 1)) {
+        key->dist = GEN_KEY_HOT;
+        return 0;
+    }
+
+    return -1;
+}
+
+static int
+parse_len(struct gen_len_config* len, const char* str)
+{
+    int n = -1;
+
+    if ((sscanf(str, "fixed:%u%n", &len->a, &n) == 1) && !str[n] &&
+        (len->a < 256)) {
+        len->dist = GEN_LEN_FIXED;
+        return 0;
+    }
+
+    n = -1;
+    if ((sscanf(str, "uniform:%u:%u%n", &len->a, &len->b, &n) == 2) &&
+        !str[n] && (len->a <= len->b) && (len->b < 256)) {
+        len->dist = GEN_LEN_UNIFORM;
+        return 0;
+    }
+
+    n = -1;
+    if ((sscanf(str, "bimodal:%u:%u:%lf%n", &len->a, &len->b, &len->prob,
+                &n) == 3) &&
+        !str[n] && (len->a < 256) && (len->b < 256) &&
+        (len->prob >= 0) && (len->prob <= 1)) {
+        len->dist = GEN_LEN_BIMODAL;
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Upper limit for the generated messages per second; keeps the
+ * timestamp computation within 64 bits. */
+static const unsigned long MAX_RATE = 1000000000;
+
+static int
+parse_gen_ulong(const char* str, unsigned long min, unsigned long max,
+                unsigned long* value)
+{
+    char* end;
+
+    errno = 0;
+    unsigned long res = strtoul(str, &end, 0);
+    if (errno || (end == str) || *end || (res < min) || (res > max)) {
+        return -1;
+    }
+    *value = res;
+
+    return 0;
+}
+
+int
+gen_config_parse(struct gen_config* self, const char* spec)
+{
+    assert(self);
+    assert(spec);
+
+    char* str = strdup(spec);
+    if (!str) {
+        perror("strdup");
+        return -1;
+    }
+
+    char* saveptr;
+
+    for (char* item = strtok_r(str, ",", &saveptr);
+               item;
+               item = strtok_r(NULL, ",", &saveptr)) {
+
+        char* value = strchr(item, '=');
+        if (!value) {
+            goto err;
+        }
+        *value++ = '\0';
+
+        int res;
+
+        if (!strcmp(item, "queue")) {
+            res = parse_key(&self->queue, value);
+        } else if (!strcmp(item, "row")) {
+            res = parse_key(&self->row, value);
+        } else if (!strcmp(item, "prio")) {
+            res = parse_key(&self->prio, value);
+            self->priorities = true;
+        } else if (!strcmp(item, "len")) {
+            res = parse_len(&self->len, value);
+        } else if (!strcmp(item, "rate")) {
+            res = parse_gen_ulong(value, 0, MAX_RATE, &self->rate);
+        } else if (!strcmp(item, "seed")) {
+            res = parse_gen_ulong(value, 0, ULONG_MAX, &self->seed);
+        } else {
+            res = -1;
+        }
+        if (res < 0) {
+            goto err;
+        }
+    }
+
+    free(str);
+
+    return 0;
+
+err:
+    free(str);
+    return -1;
+}
+
+/*
+ * Random numbers
+ */
+
+/* xorshift64* */
+static uint64_t
+next_random(struct generator* self)
+{
+    uint64_t x = self->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    self->rng = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+/* Returns a number in [0, 1). */
+static double
+next_unit(struct generator* self)
+{
+    return (next_random(self) >> 11) * 0x1.0p-53;
+}
+
+/* Returns a number in [0, n). */
+static size_t
+next_below(struct generator* self, size_t n)
+{
+    return ((next_random(self) >> 32) * n) >> 32;
+}
+
+/*
+ * Keys
+ */
+
+/* Returns the cumulative Zipf distribution over `n` keys. */
+static double*
+create_zipf_cdf(double s, size_t n)
+{
+    double* cdf = malloc(n * sizeof(*cdf));
+    if (!cdf) {
+        perror("malloc");
+        return NULL;
+    }
+
+    double sum = 0;
+    for (size_t k = 0; k < n; ++k) {
+        sum += pow(k + 1, -s);
+        cdf[k] = sum;
+    }
+    for (size_t k = 0; k < n; ++k) {
+        cdf[k] /= sum;
+    }
+
+    return cdf;
+}
+
+static size_t
+next_key(struct generator* self, const struct gen_key_config* key,
+         const double* cdf, size_t n)
+{
+    switch (key->dist) {
+        case GEN_KEY_UNIFORM:
+            break;
+        case GEN_KEY_ZIPF: {
+            /* Find the first key whose cumulative probability exceeds
+             * the random number. */
+            double u = next_unit(self);
+            size_t beg = 0;
+            size_t end = n - 1;
+            while (beg < end) {
+                size_t mid = beg + (end - beg) / 2;
+                if (cdf[mid] > u) {
+                    end = mid;
+                } else {
+                    beg = mid + 1;
+                }
+            }
+            return beg;
+        }
+        case GEN_KEY_HOT: {
+            size_t nhot = ceil(key->frac * n);
+            if (nhot >= n) {
+                break;
+            }
+            if (next_unit(self) < key->prob) {
+                return next_below(self, nhot);
+            }
+            return nhot + next_below(self, n - nhot);
+        }
+    }
+
+    return next_below(self, n);
+}
+
+static size_t
+next_len(struct generator* self)
+{
+    const struct gen_len_config* len = &self->config.len;
+
+    switch (len->dist) {
+        case GEN_LEN_FIXED:
+            return len->a;
+        case GEN_LEN_UNIFORM:
+            return len->a + next_below(self, len->b - len->a + 1);
+        case GEN_LEN_BIMODAL:
+            return next_unit(self) < len->prob ? len->a : len->b;
+    }
+
+    return 0;
+}
+
+/*
+ * Generator
+ */
+
+int
+generator_init(struct generator* self, const struct gen_config* config,
+               size_t nqueues)
+{
+    assert(self);
+    assert(config);
+    assert(nqueues);
+
+    self->config = *config;
+    self->nqueues = nqueues;
+    self->queue_cdf = NULL;
+    self->row_cdf = NULL;
+    self->prio_cdf = NULL;
+
+    if (config->queue.dist == GEN_KEY_ZIPF) {
+        self->queue_cdf = create_zipf_cdf(config->queue.s, nqueues);
+        if (!self->queue_cdf) {
+            return -1;
+        }
+    }
+    if (config->row.dist == GEN_KEY_ZIPF) {
+        self->row_cdf = create_zipf_cdf(config->row.s, 256);
+        if (!self->row_cdf) {
+            goto err_create_row_cdf;
+        }
+    }
+
+    if (config->priorities && (config->prio.dist == GEN_KEY_ZIPF)) {
+        self->prio_cdf = create_zipf_cdf(config->prio.s, NPRIORITIES);
+        if (!self->prio_cdf) {
+            goto err_create_prio_cdf;
+        }
+    }
+
+    /* xorshift requires a non-zero state. */
+    self->rng = config->seed * 0x9e3779b97f4a7c15ull + 1;
+    self->nmsgs = 0;
+
+    return 0;
+
+err_create_prio_cdf:
+    free(self->row_cdf);
+err_create_row_cdf:
+    free(self->queue_cdf);
+    return -1;
+}
+
+void
+generator_uninit(struct generator* self)
+{
+    assert(self);
+
+    free(self->prio_cdf);
+    free(self->row_cdf);
+    free(self->queue_cdf);
+}
+
+/* Returns the arrival time of the next message in nanoseconds. */
+static uint64_t
+next_tstamp(struct generator* self)
+{
+    unsigned long long n = self->nmsgs;
+    unsigned long rate = self->config.rate;
+
+    return (n / rate) * 1000000000ull + (n % rate) * 1000000000ull / rate;
+}
+
+size_t
+generator_fill(struct generator* self, uint8_t* buf, size_t len)
+{
+    assert(self);
+
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
+    const size_t tstamp_len = self->config.rate ? sizeof(uint64_t) : 0;
+
+    uint8_t* pos = buf;
+    uint8_t* end = buf + len;
+
+    while (1) {
+
+        size_t msglen = next_len(self);
+
+        if ((size_t)(end - pos) < tstamp_len + hdrlen + msglen) {
+            /* The length is lost, which doesn't change its
+             * distribution. */
+            break;
+        }
+
+        if (tstamp_len) {
+            uint64_t tstamp = next_tstamp(self);
+            memcpy(pos, &tstamp, sizeof(tstamp));
+            pos += sizeof(tstamp);
+        }
+
+        uint16_t queue = next_key(self, &self->config.queue,
+                                  self->queue_cdf, self->nqueues);
+        if (self->config.priorities) {
+            queue |= next_key(self, &self->config.prio, self->prio_cdf,
+                              NPRIORITIES) << MSG_QUEUE_BITS;
+        }
+        memcpy(pos + offsetof(struct hdr, queue), &queue, sizeof(queue));
+        pos[offsetof(struct hdr, off)] = next_key(self, &self->config.row,
+                                                  self->row_cdf, 256);
+        pos[offsetof(struct hdr, len)] = msglen;
+        pos += hdrlen;
+
+        /* Payload bytes don't matter; fill them 8 at a time. */
+        for (size_t i = 0; i < msglen; i += sizeof(uint64_t)) {
+            uint64_t value = next_random(self);
+            size_t n = msglen - i;
+            memcpy(pos + i, &value, n < sizeof(value) ? n : sizeof(value));
+        }
+        pos += msglen;
+
+        ++self->nmsgs;
+    }
+
+    return pos - buf;
+}
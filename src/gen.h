@@ -0,0 +1,119 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Distributions of the generated queue and row indices, and of the
+ * message priorities */
+enum gen_key_dist {
+    /* all keys are equally likely */
+    GEN_KEY_UNIFORM,
+    /* key k has a probability proportional to 1 / (k + 1)^s */
+    GEN_KEY_ZIPF,
+    /* the first `frac` of the keys receive `prob` of the accesses */
+    GEN_KEY_HOT
+};
+
+struct gen_key_config {
+    enum gen_key_dist dist;
+    double s;
+    double frac;
+    double prob;
+};
+
+/* Distributions of the generated message lengths */
+enum gen_len_dist {
+    /* all messages have length `a` */
+    GEN_LEN_FIXED,
+    /* lengths are uniform in [a, b] */
+    GEN_LEN_UNIFORM,
+    /* length `a` with probability `prob`, length `b` otherwise */
+    GEN_LEN_BIMODAL
+};
+
+struct gen_len_config {
+    enum gen_len_dist dist;
+    unsigned int a;
+    unsigned int b;
+    double prob;
+};
+
+struct gen_config {
+    struct gen_key_config queue;
+    struct gen_key_config row;
+    /* all messages have priority 0 unless `priorities` is set */
+    bool priorities;
+    struct gen_key_config prio;
+    struct gen_len_config len;
+    /* messages per second, or 0 for as fast as possible */
+    unsigned long rate;
+    unsigned long seed;
+};
+
+/* Sets the defaults: uniform keys and lengths at full speed. */
+void
+gen_config_init(struct gen_config* self);
+
+/* Parses a comma-separated list of settings, such as
+ *
+ *  queue=zipf:1.1,row=hot:0.1:0.9,len=bimodal:16:255:0.8,rate=10000
+ *
+ * Keys, including the priority 'prio', take 'uniform', 'zipf:S' or
+ * 'hot:FRAC:PROB'. Lengths take
+ * 'fixed:N', 'uniform:MIN:MAX' or 'bimodal:A:B:PROB'. The seed is set
+ * with 'seed=N'. Returns 0 on success, or -1 on errors.
+ */
+int
+gen_config_parse(struct gen_config* self, const char* spec);
+
+/* A generator creates messages in the format of the input stream
+ * without system calls. If a rate has been set, each message is
+ * preceded by its arrival time, as in a timed trace.
+ */
+struct generator {
+    struct gen_config config;
+
+    /* cumulative distributions for Zipf keys, or NULL */
+    double* queue_cdf;
+    size_t nqueues;
+    double* row_cdf;
+    double* prio_cdf;
+
+    uint64_t rng;
+    unsigned long long nmsgs;
+};
+
+/* Initializes a generator for messages to `nqueues` queues. Returns 0
+ * on success, or -1 on errors. */
+int
+generator_init(struct generator* self, const struct gen_config* config,
+               size_t nqueues);
+
+void
+generator_uninit(struct generator* self);
+
+/* Writes complete messages into `buf`, until the next one wouldn't
+ * fit into `len` bytes. Returns the number of written bytes. */
+size_t
+generator_fill(struct generator* self, uint8_t* buf, size_t len);
@@ -0,0 +1,146 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "hist.h"
+#include <assert.h>
+#include <limits.h>
+
+void
+hist_init(struct hist* self)
+{
+    assert(self);
+
+    for (unsigned int i = 0; i < HIST_NBUCKETS; ++i) {
+        atomic_init(self->count + i, 0);
+    }
+}
+
+/* Values below HIST_NSUB have a bucket each. Larger values are sorted
+ * by their most-significant bit and the HIST_SUB_BITS bits below. */
+static unsigned int
+bucket_of_value(unsigned long long value)
+{
+    if (value < HIST_NSUB) {
+        return value;
+    }
+
+    unsigned int msb = (sizeof(value) * CHAR_BIT - 1) - __builtin_clzll(value);
+    unsigned int shift = msb - HIST_SUB_BITS;
+
+    return (shift + 1) * HIST_NSUB + ((value >> shift) & (HIST_NSUB - 1));
+}
+
+/* Returns the largest value that falls into the bucket. */
+static unsigned long long
+max_value_of_bucket(unsigned int bucket)
+{
+    if (bucket < HIST_NSUB) {
+        return bucket;
+    }
+
+    unsigned int shift = (bucket / HIST_NSUB) - 1;
+    unsigned long long sub = HIST_NSUB + (bucket % HIST_NSUB);
+
+    return ((sub + 1) << shift) - 1;
+}
+
+void
+hist_add(struct hist* self, unsigned long long value)
+{
+    assert(self);
+
+    /* There's only a single writer, so we don't need an atomic
+     * read-modify-write operation. */
+    atomic_ulong* count = self->count + bucket_of_value(value);
+    atomic_store_explicit(count,
+                          atomic_load_explicit(count, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+void
+hist_merge(struct hist* self, const struct hist* src)
+{
+    assert(self);
+    assert(src);
+
+    for (unsigned int i = 0; i < HIST_NBUCKETS; ++i) {
+        unsigned long n = atomic_load_explicit(src->count + i,
+                                               memory_order_relaxed);
+        atomic_fetch_add_explicit(self->count + i, n, memory_order_relaxed);
+    }
+}
+
+unsigned long
+hist_count(const struct hist* self)
+{
+    assert(self);
+
+    unsigned long n = 0;
+
+    for (unsigned int i = 0; i < HIST_NBUCKETS; ++i) {
+        n += atomic_load_explicit(self->count + i, memory_order_relaxed);
+    }
+
+    return n;
+}
+
+unsigned long long
+hist_percentile(const struct hist* self, double percentile)
+{
+    assert(self);
+    assert(percentile >= 0 && percentile <= 100);
+
+    unsigned long total = hist_count(self);
+    if (!total) {
+        return 0;
+    }
+
+    /* The rank of the requested value, counted from 1 */
+    unsigned long rank = (percentile / 100) * total + 0.5;
+    if (!rank) {
+        rank = 1;
+    }
+
+    unsigned long n = 0;
+
+    for (unsigned int i = 0; i < HIST_NBUCKETS; ++i) {
+        n += atomic_load_explicit(self->count + i, memory_order_relaxed);
+        if (n >= rank) {
+            return max_value_of_bucket(i);
+        }
+    }
+
+    /* Concurrent writers added values after we counted them. */
+    return hist_max(self);
+}
+
+unsigned long long
+hist_max(const struct hist* self)
+{
+    assert(self);
+
+    for (unsigned int i = HIST_NBUCKETS; i; --i) {
+        if (atomic_load_explicit(self->count + i - 1, memory_order_relaxed)) {
+            return max_value_of_bucket(i - 1);
+        }
+    }
+
+    return 0;
+}
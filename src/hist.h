@@ -0,0 +1,67 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+
+/* Number of sub-buckets per power of two, as bits. With 16 sub-buckets
+ * each recorded value is accurate within 1/16 of its magnitude. */
+#define HIST_SUB_BITS   4
+
+#define HIST_NSUB       (1u << HIST_SUB_BITS)
+
+#define HIST_NBUCKETS   ((64 - HIST_SUB_BITS + 1) * HIST_NSUB)
+
+/* A log-linear histogram for latencies, similar to HdrHistogram. The
+ * bucket width doubles with each power of two, so the histogram has a
+ * fixed size and constant relative precision over 64-bit values.
+ *
+ * Each histogram has a single writer thread. Other threads can read
+ * it concurrently and merge it into a private histogram for reports.
+ */
+struct hist {
+    atomic_ulong count[HIST_NBUCKETS];
+};
+
+void
+hist_init(struct hist* self);
+
+/* Records a value; only to be called by the histogram's writer. */
+void
+hist_add(struct hist* self, unsigned long long value);
+
+/* Adds the counts of `src` to `self`. */
+void
+hist_merge(struct hist* self, const struct hist* src);
+
+/* Returns the number of recorded values. */
+unsigned long
+hist_count(const struct hist* self);
+
+/* Returns the value below or at which `percentile` percent of the
+ * recorded values lie. The result is the largest value of the
+ * respective bucket. Returns 0 for empty histograms. */
+unsigned long long
+hist_percentile(const struct hist* self, double percentile);
+
+/* Returns the largest recorded value, or 0 for empty histograms. */
+unsigned long long
+hist_max(const struct hist* self);
@@ -19,25 +19,58 @@
  */
 
 #include "in.h"
+#include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <picotm/fcntl.h>
 #include <picotm/picotm.h>
 #include <picotm/picotm-tm-ctypes.h>
+#include <picotm/stdbool.h>
+#include <picotm/stddef.h>
 #include <picotm/stdlib.h>
+#include <picotm/string.h>
 #include <picotm/unistd.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "affinity.h"
+#include "bucket.h"
+#include "clock.h"
 #include "queue.h"
+#include "reader.h"
 #include "recovery.h"
+#include "trace.h"
+#include "txstats.h"
+
+/* Upper limit for sleeps between checks of the stop conditions */
+static const unsigned long long POLL_INTERVAL_NSECS = 10000000;
+
+void
+in_stats_init(struct in_stats* self)
+{
+    assert(self);
+
+    atomic_init(&self->nmsgs, 0);
+    atomic_init(&self->nbytes, 0);
+    atomic_init(&self->ncommits, 0);
+    atomic_init(&self->naborts, 0);
+    atomic_init(&self->ndropped, 0);
+    atomic_init(&self->ncoalesced, 0);
+    atomic_init(&self->done, false);
+}
 
 static int
 open_input_file(const char* filename)
 {
     int fd;
 
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
     picotm_begin
+        tx_site_attempt(&site);
 
         /* Privatize the memory of the argument and filename */
         privatize_c_tx(filename, '\0', PICOTM_TM_PRIVATIZE_LOAD);
@@ -49,131 +82,595 @@ open_input_file(const char* filename)
         store_int_tx(&fd, tx_fd);
 
     picotm_commit
-        int res = recover_from_tx_error(__FILE__, __LINE__);
+        int res = recover_from_tx_error(&site);
         if (res < 0) {
             return -1;
         }
         picotm_restart();
     picotm_end
 
+    tx_site_commit(&site);
+
     return fd;
 }
 
 static void
 close_file_descriptor(int fd)
 {
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
     picotm_begin
+        tx_site_attempt(&site);
+
         close_tx(fd);
     picotm_commit
-        int res = recover_from_tx_error(__FILE__, __LINE__);
+        int res = recover_from_tx_error(&site);
         if (res < 0) {
             return;
         }
         picotm_restart();
     picotm_end
+
+    tx_site_commit(&site);
 }
 
 static struct queue_entry*
-read_file(int fd)
+create_queue_entry_from_msg_tx(const uint8_t* msg, bool is_mapped)
 {
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
     struct queue_entry* entry;
 
+    if (is_mapped) {
+        /* Mapped input stays valid for the lifetime of the program, so
+         * the queue entry refers to the payload in place. The payload's
+         * only copy happens when the processing thread applies it. */
+        entry = create_queue_entry_with_buf_tx(msg + hdrlen);
+        privatize_tx(&entry->msg, hdrlen, PICOTM_TM_PRIVATIZE_STORE);
+        memcpy(&entry->msg, msg, hdrlen);
+    } else {
+        entry = create_queue_entry_tx();
+        size_t len = hdrlen + msg[offsetof(struct hdr, len)];
+        privatize_tx(&entry->msg, len, PICOTM_TM_PRIVATIZE_STORE);
+        memcpy(&entry->msg, msg, len);
+    }
+
+    return entry;
+}
+
+/* Replaces the message of a queued entry with `msg`. The processing
+ * thread might access the entry concurrently, so all stores are
+ * transactional. */
+static void
+update_queue_entry_from_msg_tx(struct queue_entry* entry, const uint8_t* msg,
+                               bool is_mapped)
+{
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
+    if (is_mapped) {
+        store_ptr_tx(&entry->buf, msg + hdrlen);
+        memcpy_tx(&entry->msg, msg, hdrlen);
+    } else {
+        size_t len = hdrlen + msg[offsetof(struct hdr, len)];
+        memcpy_tx(&entry->msg, msg, len);
+    }
+}
+
+/* Per-queue results of a batch transaction */
+struct batch_out {
+    size_t nmsgs;       /* number of enqueued messages */
+    size_t ndropped;    /* number of discarded messages */
+    size_t ndequeued;   /* number of discarded messages that had been
+                         * enqueued by earlier batches */
+    size_t ncoalesced;  /* number of messages that replaced queued ones */
+    size_t len;         /* largest length of the queue */
+    bool wakeup;        /* processing thread requires a wakeup */
+};
+
+/* Overall results of a batch transaction */
+struct batch_result {
+    size_t nbytes;  /* number of read bytes */
+    unsigned long nrestarts; /* number of transaction restarts */
+    struct queue* full; /* queue that ended the batch, or NULL */
+};
+
+static void
+inc_size_t_tx(size_t* value)
+{
+    store_size_t_tx(value, load_size_t_tx(value) + 1);
+}
+
+/* Returns the index of the output queue for a message with the header
+ * field `queue`. Priority queues take the field's upper bits as the
+ * message's priority; other queues are selected by the whole field. */
+static size_t
+outq_index(struct queue* const* outq, size_t noutqs, uint16_t queue)
+{
+    if (outq[0]->backend == QUEUE_BACKEND_PRIORITY) {
+        return msg_queue(queue) % noutqs;
+    }
+    return queue % noutqs;
+}
+
+/* Reads up to `batch_size` messages from the frame reader and pushes
+ * them to their output queues. All messages of a batch are parsed and
+ * enqueued within a single transaction. Messages of timed input are
+ * only read if they arrived no later than `due`. The results for each
+ * output queue are returned in the corresponding element of `out`.
+ *
+ * Full transactional queues apply their overflow policy to further
+ * messages. A full queue that blocks ends the batch; the caller has to
+ * wait for room in `result->full` before reading the next batch.
+ *
+ * If `trace` is not NULL, the messages are also recorded into the
+ * trace. The records are built in `recs`.
+ *
+ * Ring-backed queues cannot be modified within transactions. For them,
+ * the messages are stored in `staged` and have to be pushed after the
+ * transaction committed.
+ *
+ * Returns the number of read messages, or -1 on errors.
+ */
+static ssize_t
+read_file(struct frame_reader* reader, unsigned long long due,
+          struct queue* const* outq, size_t noutqs, size_t batch_size,
+          struct batch_out* out, struct queue_entry** staged,
+          const struct trace_writer* trace, uint8_t* recs,
+          struct batch_result* result)
+{
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
+    const bool is_mapped = frame_reader_is_mapped(reader);
+
+    size_t nmsgs;
+
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
     picotm_begin
+        tx_site_attempt(&site);
 
-        struct queue_entry* tx_entry = create_queue_entry_tx();
+        size_t i;
+        size_t nbytes = 0;
+        size_t nrecs = 0;
+        struct queue* full = NULL;
 
-        /* Read message header from input stream. The value of `fd` is a
-         * constant on the stack; no need to load or privatize. The first
-         * 4 byte are considered meta data. */
-        read_tx(fd, &tx_entry->msg, 4);
+        for (i = 0; i < batch_size; ++i) {
 
-        /* Read data into buffer. With `read_tx()` the buffer `msg->buf` is
-         * automatically privatized by the TM module.
-         */
-        read_tx(fd, tx_entry->msg.buf, tx_entry->msg.len);
+            /* Parse the next message from the reader's buffer. If the
+             * transaction aborts, the consumed bytes are returned to
+             * the buffer. */
+            const uint8_t* msg = frame_reader_next_tx(reader, due);
+            if (!msg) {
+                break;
+            }
+
+            /* Pick one of the output queues. The reader privatized
+             * the message. */
+            uint16_t queue;
+            memcpy(&queue, msg + offsetof(struct hdr, queue), sizeof(queue));
+            size_t qi = outq_index(outq, noutqs, queue);
+
+            enum queue_reserve reserve = QUEUE_RESERVED;
+            struct queue_entry* pending = NULL;
+
+            if (outq[qi]->backend != QUEUE_BACKEND_RING) {
+                reserve = queue_reserve_tx(outq[qi],
+                                           msg[offsetof(struct hdr, off)],
+                                           queue_msg_priority(outq[qi], queue),
+                                           &pending);
+                if (reserve == QUEUE_FULL) {
+                    /* Leave the message in the reader's buffer until
+                     * the queue has room. */
+                    frame_reader_unread_tx(reader, msg);
+                    full = outq[qi];
+                    break;
+                }
+            }
+
+            unsigned long long read_tstamp = monotonic_nsecs();
+
+            if (trace) {
+                nrecs += trace_put_record(trace, recs + nrecs, msg,
+                                          read_tstamp);
+            }
 
-        /* Export message from transaction context.
+            nbytes += hdrlen + msg[offsetof(struct hdr, len)];
+
+            switch (reserve) {
+                case QUEUE_DISCARD:
+                    inc_size_t_tx(&out[qi].ndropped);
+                    continue;
+                case QUEUE_COALESCE:
+                    update_queue_entry_from_msg_tx(pending, msg, is_mapped);
+                    store_ullong_tx(&pending->read_tstamp, read_tstamp);
+                    store_ullong_tx(&pending->enqueue_tstamp,
+                                    monotonic_nsecs());
+                    inc_size_t_tx(&out[qi].ncoalesced);
+                    continue;
+                case QUEUE_RESERVED_DROPPED:
+                    inc_size_t_tx(&out[qi].ndropped);
+                    inc_size_t_tx(&out[qi].ndequeued);
+                    break;
+                default:
+                    break;
+            }
+
+            struct queue_entry* tx_entry =
+                create_queue_entry_from_msg_tx(msg, is_mapped);
+            store_ullong_tx(&tx_entry->read_tstamp, read_tstamp);
+
+            switch (outq[qi]->backend) {
+                case QUEUE_BACKEND_TXQUEUE:
+                case QUEUE_BACKEND_PRIORITY: {
+                    store_ullong_tx(&tx_entry->enqueue_tstamp,
+                                    monotonic_nsecs());
+                    size_t len = queue_push_tx(outq[qi], tx_entry);
+                    /* The processing thread only waits for messages
+                     * after it found its queue empty. Wake it up if
+                     * this transaction fills the empty queue. */
+                    if (len == 1) {
+                        store_bool_tx(&out[qi].wakeup, true);
+                    }
+                    if (len > load_size_t_tx(&out[qi].len)) {
+                        store_size_t_tx(&out[qi].len, len);
+                    }
+                    break;
+                }
+                case QUEUE_BACKEND_RING:
+                    /* The ring's state can change concurrently, so we
+                     * cannot tell whether it's been empty. */
+                    store_ptr_tx(staged + i, tx_entry);
+                    store_bool_tx(&out[qi].wakeup, true);
+                    break;
+            }
+
+            inc_size_t_tx(&out[qi].nmsgs);
+        }
+
+        if (nrecs) {
+            trace_append_tx(trace, recs, nrecs);
+        }
+
+        /* Export number of messages from transaction context.
          */
-        store_ptr_tx(&entry, tx_entry);
+        store_size_t_tx(&nmsgs, i);
+        store_size_t_tx(&result->nbytes, nbytes);
+        store_ulong_tx(&result->nrestarts, picotm_number_of_restarts());
+        store_ptr_tx(&result->full, full);
 
     picotm_commit
-        int res = recover_from_tx_error(__FILE__, __LINE__);
+        int res = recover_from_tx_error(&site);
         if (res < 0) {
-            return NULL;
+            return -1;
         }
         picotm_restart();
     picotm_end
 
-    return entry;
+    tx_site_commit(&site);
+
+    return nmsgs;
 }
 
-static void
-in_main_loop(const char* filename, struct queue* outq, size_t noutqs)
+static int
+map_input_file(int fd, const void** mem, size_t* len)
 {
-    int fd = open_input_file(filename);
-    if (fd < 0) {
-        return;
+    struct stat buf;
+    int res = fstat(fd, &buf);
+    if (res < 0) {
+        perror("fstat");
+        return -1;
+    }
+    if (!S_ISREG(buf.st_mode)) {
+        fprintf(stderr, "Mapped input requires a regular file.\n");
+        return -1;
+    }
+
+    *mem = NULL;
+    *len = buf.st_size;
+
+    if (!*len) {
+        return 0; /* empty file; nothing to map */
     }
 
+    void* addr = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(addr, *len, MADV_SEQUENTIAL);
+
+    *mem = addr;
+
+    return 0;
+}
+
+/* Returns true if `flag` is not NULL and has been set. */
+static bool
+is_set(const atomic_bool* flag)
+{
+    return flag && atomic_load_explicit(flag, memory_order_acquire);
+}
+
+/* Sleeps until the monotonic clock reaches `nsecs`. Returns false if
+ * the thread has been stopped in the meantime. */
+static bool
+sleep_until_or_stop(const struct in_config* config, unsigned long long nsecs)
+{
     while (1) {
-        struct queue_entry* entry = read_file(fd);
-        if (!entry) {
-            goto out;
+        if (is_set(config->stop) || is_set(config->failed)) {
+            return false;
+        }
+        unsigned long long now = monotonic_nsecs();
+        if (now >= nsecs) {
+            return true;
         }
+        if (nsecs - now > POLL_INTERVAL_NSECS) {
+            sleep_until(now + POLL_INTERVAL_NSECS);
+        } else {
+            sleep_until(nsecs);
+        }
+    }
+}
 
-        /* Pick one of the output queues, enqueue the message and
-         * send a signal to one of the processing threads.
-         */
+static void
+in_main_loop(const struct in_config* config, struct queue* const* outq,
+             size_t noutqs, struct in_stats* stats)
+{
+    const size_t batch_size = config->batch_size;
+
+    int fd = -1;
+
+    if (config->source != IN_SOURCE_GENERATE) {
+        fd = open_input_file(config->filename);
+        if (fd < 0) {
+            return;
+        }
+    }
+
+    struct frame_reader* reader = malloc(sizeof(*reader));
+    if (!reader) {
+        perror("malloc");
+        goto err_malloc_reader;
+    }
+
+    bool timed = false;
+    struct generator* gen = NULL;
+
+    if (config->replay) {
+        int res = trace_read_header(fd, &timed);
+        if (res < 0) {
+            goto err_trace_read_header;
+        }
+        if ((config->pace == IN_PACE_RECORDED) && !timed) {
+            fprintf(stderr, "Trace contains no arrival times.\n");
+            goto err_trace_read_header;
+        }
+    }
+
+    switch (config->source) {
+        case IN_SOURCE_READ:
+            frame_reader_init(reader, fd, timed);
+            break;
+        case IN_SOURCE_MMAP: {
+            /* Queue entries refer to the mapped memory, so the mapping
+             * is never removed. */
+            const void* mem;
+            size_t len;
+            int res = map_input_file(fd, &mem, &len);
+            if (res < 0) {
+                goto err_map_input_file;
+            }
+            if (config->replay) {
+                /* Skip the trace's header. */
+                mem = (const uint8_t*)mem + sizeof(struct trace_header);
+                len -= sizeof(struct trace_header);
+            }
+            frame_reader_init_mapped(reader, mem, len, timed);
+            break;
+        }
+        case IN_SOURCE_GENERATE: {
+            gen = malloc(sizeof(*gen));
+            if (!gen) {
+                perror("malloc");
+                goto err_malloc_gen;
+            }
+            int res = generator_init(gen, &config->gen, noutqs);
+            if (res < 0) {
+                goto err_generator_init;
+            }
+            frame_reader_init_generated(reader, gen);
+            /* Generated arrival times set the rate. */
+            timed = reader->timed;
+            break;
+        }
+    }
+
+    const bool paced = timed && (gen || (config->pace == IN_PACE_RECORDED));
+
+    /* Arrival times of the input are relative to this time. */
+    const unsigned long long start_nsecs = monotonic_nsecs();
+
+    /* Each batch takes its messages' tokens at once, so the bucket
+     * holds up to a batch. */
+    struct token_bucket bucket;
+    if (config->rate) {
+        token_bucket_init(&bucket, config->rate, batch_size);
+    }
+
+    struct batch_out* out = malloc(noutqs * sizeof(*out));
+    if (!out) {
+        perror("malloc");
+        goto err_malloc;
+    }
+
+    struct queue_entry** staged = malloc(batch_size * sizeof(*staged));
+    if (!staged) {
+        perror("malloc");
+        goto err_malloc_staged;
+    }
+
+    uint8_t* recs = NULL;
+    if (config->record) {
+        recs = malloc(batch_size * TRACE_MAX_RECORD_SIZE);
+        if (!recs) {
+            perror("malloc");
+            goto err_malloc_recs;
+        }
+    }
+
+    while (!is_set(config->stop) && !is_set(config->failed)) {
+
+        /* Buffer enough input for a full batch of maximum-sized
+         * messages. Most calls return without a system call. */
+        ssize_t navail = frame_reader_fill(reader,
+                                           batch_size * TRACE_MAX_RECORD_SIZE);
+        if (navail <= 0) {
+            goto out;
+        }
 
-        struct queue* q = outq + (entry->msg.queue % noutqs);
+        unsigned long long due = ULLONG_MAX;
 
-        picotm_begin
-            struct txqueue* queue = txqueue_of_state_tx(&q->queue);
-            txqueue_push_tx(queue, &entry->entry);
-        picotm_commit
-            int res = recover_from_tx_error(__FILE__, __LINE__);
+        if (paced) {
+            /* Wait until the next message arrives. The batch takes
+             * all messages that arrived until then. */
+            unsigned long long tstamp;
+            int res = frame_reader_peek_tstamp(reader, &tstamp);
             if (res < 0) {
+                goto out; /* incomplete message at end of input */
+            }
+            /* Traces can pause for a long time; stop meanwhile. */
+            if (!sleep_until_or_stop(config, start_nsecs + tstamp)) {
+                goto out;
+            }
+            due = monotonic_nsecs() - start_nsecs;
+        }
+
+        memset(out, 0, noutqs * sizeof(*out));
+
+        for (size_t i = 0; i < batch_size; ++i) {
+            staged[i] = NULL;
+        }
+
+        if (config->rate) {
+            /* At low rates, the wait for tokens takes long; stop
+             * meanwhile. Only the final spin remains for the bucket. */
+            unsigned long long wake_nsecs =
+                token_bucket_wake_nsecs(&bucket, batch_size);
+            if (!sleep_until_or_stop(config, wake_nsecs)) {
                 goto out;
             }
-            picotm_restart();
-        picotm_end
+            token_bucket_take(&bucket, batch_size);
+        }
+
+        struct batch_result result;
 
-        /* TODO: Could signalling be done transactionally? */
-        int err = pthread_mutex_lock(&q->mutex);
-        if (err) {
-            errno = err;
-            perror("pthread_mutex_lock");
-            abort();
+        ssize_t nmsgs = read_file(reader, due, outq, noutqs, batch_size, out,
+                                  staged, config->record, recs, &result);
+        if (nmsgs < 0) {
+            goto out;
+        } else if (!nmsgs && !result.full) {
+            goto out; /* incomplete message at end of input */
         }
-        err = pthread_cond_signal(&q->cond);
-        if (err) {
-            errno = err;
-            perror("pthread_cond_signal");
-            abort();
+
+        if (config->rate) {
+            /* Short batches leave tokens for the next one. */
+            token_bucket_put(&bucket, batch_size - nmsgs);
         }
-        err = pthread_mutex_unlock(&q->mutex);
-        if (err) {
-            errno = err;
-            perror("pthread_mutex_unlock");
-            abort();
+
+        atomic_fetch_add_explicit(&stats->nmsgs, nmsgs,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->nbytes, result.nbytes,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->ncommits, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->naborts, result.nrestarts,
+                                  memory_order_relaxed);
+
+        /* Publish staged messages in ring-backed queues. The entries
+         * remain private to this thread until they have been pushed. */
+        size_t ndropped = 0;
+        size_t ncoalesced = 0;
+
+        for (ssize_t i = 0; i < nmsgs; ++i) {
+            if (staged[i]) {
+                staged[i]->enqueue_tstamp = monotonic_nsecs();
+                size_t qi = outq_index(outq, noutqs,
+                                       staged[i]->msg.queue);
+                ndropped += queue_push(outq[qi], staged[i]);
+            }
         }
 
-        sleep(1);
+        /* The batch has been committed. Wake up each processing
+         * thread that waits for messages from the batch. Each queue
+         * is signalled at most once per batch. */
+        for (size_t i = 0; i < noutqs; ++i) {
+            if (out[i].nmsgs) {
+                queue_account_push(outq[i], out[i].nmsgs);
+            }
+            if (out[i].ndequeued) {
+                queue_account_pop(outq[i], out[i].ndequeued);
+            }
+            if (out[i].len || out[i].ndropped || out[i].ncoalesced) {
+                queue_account_overflow(outq[i], out[i].len, out[i].ndropped,
+                                       out[i].ncoalesced);
+            }
+            if (out[i].wakeup) {
+                queue_signal(outq[i]);
+            }
+            ndropped += out[i].ndropped;
+            ncoalesced += out[i].ncoalesced;
+        }
+
+        if (ndropped) {
+            atomic_fetch_add_explicit(&stats->ndropped, ndropped,
+                                      memory_order_relaxed);
+        }
+        if (ncoalesced) {
+            atomic_fetch_add_explicit(&stats->ncoalesced, ncoalesced,
+                                      memory_order_relaxed);
+        }
+
+        if (result.full) {
+            /* Backpressure: stop reading input until the processing
+             * thread made room. */
+            queue_wait_for_room(result.full, config->failed);
+        }
     }
 
 out:
-    close_file_descriptor(fd);
+    free(recs);
+err_malloc_recs:
+    free(staged);
+err_malloc_staged:
+    free(out);
+err_malloc:
+    if (gen) {
+        generator_uninit(gen);
+    }
+err_generator_init:
+    free(gen);
+err_malloc_gen:
+err_map_input_file:
+err_trace_read_header:
+    free(reader);
+err_malloc_reader:
+    if (fd >= 0) {
+        close_file_descriptor(fd);
+    }
 }
 
 struct in_main_arg {
-    const char* filename;
-    struct queue* outq;
+    struct in_config config;
+    struct queue* const* outq;
     size_t noutqs;
+    struct in_stats* stats;
 };
 
 static void
 thread_cleanup(void* arg)
 {
+    flush_queue_entry_outboxes();
+
     picotm_release();
 
     free(arg);
@@ -184,7 +681,9 @@ in_main(struct in_main_arg* arg)
 {
     pthread_cleanup_push(thread_cleanup, arg);
 
-    in_main_loop(arg->filename, arg->outq, arg->noutqs);
+    in_main_loop(&arg->config, arg->outq, arg->noutqs, arg->stats);
+
+    atomic_store_explicit(&arg->stats->done, true, memory_order_release);
 
     pthread_cleanup_pop(1);
 }
@@ -197,37 +696,55 @@ in_main_cb(void* arg)
 }
 
 int
-run_in_thread(const char* filename, struct queue* outq, size_t noutqs,
+run_in_thread(const struct in_config* config, struct queue* const* outq,
+              size_t noutqs, struct in_stats* stats, const cpu_set_t* cpus,
               pthread_t* thread)
 {
     struct in_main_arg* arg = NULL;
 
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
     picotm_begin
+        tx_site_attempt(&site);
+
         struct in_main_arg* tx_arg = malloc_tx(sizeof(*tx_arg));
-        tx_arg->filename = filename;
+        memcpy_tx(&tx_arg->config, config, sizeof(tx_arg->config));
         tx_arg->outq = outq;
         tx_arg->noutqs = noutqs;
+        tx_arg->stats = stats;
 
         store_ptr_tx(&arg, tx_arg);
 
     picotm_commit
-        int res = recover_from_tx_error(__FILE__, __LINE__);
+        int res = recover_from_tx_error(&site);
         if (res < 0) {
             return -1;
         }
         picotm_restart();
     picotm_end
 
-    int err = pthread_create(thread, NULL, in_main_cb, arg);
+    tx_site_commit(&site);
+
+    pthread_attr_t attr;
+    int res = init_thread_attr(&attr, cpus);
+    if (res < 0) {
+        goto err_init_thread_attr;
+    }
+
+    int err = pthread_create(thread, &attr, in_main_cb, arg);
     if (err) {
         errno = err;
         perror("pthread_create");
         goto err_pthread_create;
     }
 
+    pthread_attr_destroy(&attr);
+
     return 0;
 
 err_pthread_create:
+    pthread_attr_destroy(&attr);
+err_init_thread_attr:
     free(arg);
     return -1;
 }
@@ -21,10 +21,74 @@
 #pragma once
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include "gen.h"
 
 struct queue;
+struct trace_writer;
 
+enum in_source {
+    /* Read messages from the input file into private buffers. */
+    IN_SOURCE_READ,
+    /* Map the input file into memory and parse messages in place. The
+     * input file has to be a regular file. */
+    IN_SOURCE_MMAP,
+    /* Generate messages without reading a file. */
+    IN_SOURCE_GENERATE
+};
+
+/* How to replay a trace */
+enum in_pace {
+    /* as fast as possible */
+    IN_PACE_FAST,
+    /* at the recorded arrival times; requires a timed trace */
+    IN_PACE_RECORDED
+};
+
+struct in_config {
+    const char* filename;
+    enum in_source source;
+    size_t batch_size;
+    /* messages per second, or 0 for no limit */
+    unsigned long rate;
+    /* the input file is a trace */
+    bool replay;
+    enum in_pace pace;
+    /* if not NULL, record all messages into this trace */
+    struct trace_writer* record;
+    /* settings for generated input */
+    struct gen_config gen;
+    /* if not NULL, the thread returns after its batch once the flag
+     * has been set */
+    const atomic_bool* stop;
+    /* if not NULL, set when a processing thread failed; the thread
+     * then returns without waiting for room in full queues */
+    const atomic_bool* failed;
+};
+
+/* Statistics of an input thread */
+struct in_stats {
+    alignas(64) atomic_ulong nmsgs;
+    atomic_ulong nbytes;
+    atomic_ulong ncommits;
+    atomic_ulong naborts; /* restarts of committed transactions */
+    atomic_ulong ndropped; /* messages discarded by full queues */
+    atomic_ulong ncoalesced; /* messages that replaced queued ones */
+    atomic_bool done; /* thread reached the end of its input */
+};
+
+void
+in_stats_init(struct in_stats* self);
+
+/* Starts an input thread that routes messages from the input file to
+ * the output queues. If `cpus` is not NULL, the thread is pinned to
+ * the given CPUs. Each input thread reads the input file on its own.
+ */
 int
-run_in_thread(const char* filename, struct queue* outq, size_t noutqs,
+run_in_thread(const struct in_config* config, struct queue* const* outq,
+              size_t noutqs, struct in_stats* stats, const cpu_set_t* cpus,
               pthread_t* thread);
@@ -18,59 +18,836 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
 #include <pthread.h>
+#include <stdalign.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "affinity.h"
+#include "bench.h"
 #include "buf.h"
+#include "gen.h"
 #include "in.h"
+#include "pipeline.h"
 #include "proc.h"
-#include "ptr.h"
 #include "queue.h"
+#include "store.h"
+#include "sum.h"
+#include "trace.h"
+#include "txstats.h"
 #include "ui.h"
+#include "wakeup.h"
+#include "wal.h"
 
 static const char DEV_URANDOM[] = "/dev/urandom";
 
-static struct queue g_queue[4] = {
-    QUEUE_INITIALIZER(g_queue[0]),
-    QUEUE_INITIALIZER(g_queue[1]),
-    QUEUE_INITIALIZER(g_queue[2]),
-    QUEUE_INITIALIZER(g_queue[3])
-};
+/* Upper limit for the number of queues and buffers. Messages select
+ * their queue with a 16-bit index. */
+static const unsigned long MAX_QUEUES = 1ul << 16;
 
-static struct data_buf g_data_buf[4];
+/* Upper limit for the number of priority queues. The upper bits of the
+ * index carry the message's priority. */
+static const unsigned long MAX_PRIORITY_QUEUES = 1ul << MSG_QUEUE_BITS;
+
+/* Upper limit for the number of input and processing threads */
+static const unsigned long MAX_THREADS = 1024;
+
+/* Upper limit for the number of messages per input transaction. Each
+ * message adds an allocation, two reads and a queue push to the
+ * transaction, so large batches increase the cost of aborts. */
+static const unsigned long MAX_BATCH_SIZE = 1024;
+
+/* Upper limit for the number of messages per processing transaction.
+ * Each message adds a 256-byte field to the transaction's write set. */
+static const unsigned long MAX_DRAIN_SIZE = 256;
+
+/* Upper limit for the number of entries in a queue */
+static const unsigned long MAX_QUEUE_CAPACITY = 1ul << 24;
+
+/* Upper limit for busy-polling before a processing thread sleeps */
+static const unsigned long MAX_SPIN_USECS = 1000000;
+
+/* Upper limit for the input rate; keeps the token bucket's nanosecond
+ * arithmetic within 64 bits */
+static const unsigned long MAX_RATE = 1000000000;
+
+/* Upper limit for the delay per level of priority */
+static const unsigned long MAX_AGING = 1ul << 24;
+
+/* Upper limits for the write-ahead log's sync interval and threshold,
+ * and for the checkpoint interval */
+static const unsigned long MAX_GROUP_USECS = 10000000;
+static const unsigned long MAX_GROUP_BYTES = 1ul << 30;
+static const unsigned long MAX_CHECKPOINT_SECS = 24 * 60 * 60;
+
+/* Upper limit and default for the run time in headless mode */
+static const unsigned long MAX_DURATION_SECS = 365 * 24 * 60 * 60;
+static const unsigned long DEFAULT_DURATION_SECS = 10;
+
+static void
+print_usage(FILE* stream, const char* progname)
+{
+    fprintf(stream,
+            "Usage: %s [options]\n"
+            "\n"
+            "Options:\n"
+            "  -a, --rate=N         read N messages per second in total, at\n"
+            "                       most 1000000000; 0 for no limit (default:\n"
+            "                       one batch per second with UI, no limit\n"
+            "                       otherwise)\n"
+            "  -B, --buffers=N      sort messages into N buffers; at most\n"
+            "                       the number of queues (default: 4)\n"
+            "  -b, --batch-size=N   read and enqueue up to N messages per\n"
+            "                       input transaction (default: 1)\n"
+            "  -C, --proc-cpus=SETS pin processing threads to the\n"
+            "                       colon-separated CPU lists in SETS,\n"
+            "                       such as '0:1:2-3,6'\n"
+            "  -c, --in-cpus=SETS   pin input threads to the CPU lists\n"
+            "                       in SETS\n"
+            "  -d, --drain-size=K   apply up to K messages per processing\n"
+            "                       transaction (default: 1)\n"
+            "  -e, --aging=N        let each message of a priority queue be\n"
+            "                       overtaken by at most N later messages\n"
+            "                       per level of priority (default: 256)\n"
+            "  -G, --group-bytes=N  sync the log once N bytes are pending\n"
+            "                       (default: 1048576)\n"
+            "  -g, --group-usecs=N  sync the log at least every N\n"
+            "                       microseconds, or once all processing\n"
+            "                       threads wait for it (default: 10000)\n"
+            "  -H, --headless       run without UI and as fast as possible;\n"
+            "                       print throughput and latency at exit\n"
+            "  -I, --in-threads=N   run N input threads (default: 1)\n"
+            "  -i, --input=FILE     read messages from FILE\n"
+            "                       (default: %s)\n"
+            "  -k, --checkpoint-secs=N\n"
+            "                       write a checkpoint of the buffers every\n"
+            "                       N seconds with --wal (default: 60)\n"
+            "  -n, --count=N        stop after N messages have been applied;\n"
+            "                       implies --headless\n"
+            "  -m, --mmap           map the input file into memory and\n"
+            "                       parse messages in place; requires a\n"
+            "                       regular file\n"
+            "  -o, --overflow=POLICY\n"
+            "                       handle messages for full queues by\n"
+            "                       POLICY; one of 'block' (default),\n"
+            "                       'drop-newest', 'drop-oldest' or\n"
+            "                       'coalesce'; 'coalesce' excludes the\n"
+            "                       ring backend\n"
+            "  -P, --proc-threads=N run N processing threads; at most the\n"
+            "                       number of queues (default: 4)\n"
+            "  -p, --persist=FILE   keep the buffers in FILE and restore\n"
+            "                       them on the next start; flush each\n"
+            "                       buffer after every commit; rows can\n"
+            "                       tear on crashes unless --wal is given\n"
+            "  -Q, --queues=N       distribute messages among N queues; at\n"
+            "                       most 65536, or 16384 with\n"
+            "                       --queue=priority (default: 4)\n"
+            "  -q, --queue=BACKEND  use BACKEND for the message queues; one\n"
+            "                       of 'txqueue' (default), 'ring' or\n"
+            "                       'priority'\n"
+            "  -R, --record=FILE    record all messages into the trace FILE\n"
+            "  -r, --capacity=N     hold up to N messages in each queue\n"
+            "                       (default: 4096)\n"
+            "  -S, --steal          let idle processing threads apply\n"
+            "                       messages from other queues\n"
+            "  -s, --spin-usecs=N   busy-poll for N microseconds before\n"
+            "                       sleeping with --wait=spin (default: 50)\n"
+            "  -T, --record-times   record the messages' arrival times\n"
+            "  -t, --duration=SECS  stop after SECS seconds; implies\n"
+            "                       --headless (default: 10 if headless)\n"
+            "  -u, --generate=SPEC  generate messages instead of reading\n"
+            "                       them; SPEC is a comma-separated list of\n"
+            "                       queue=KEYS, row=KEYS, prio=KEYS,\n"
+            "                       len=LENS, rate=N and seed=N; KEYS is one\n"
+            "                       of 'uniform', 'zipf:S' or\n"
+            "                       'hot:FRAC:PROB'; prio requires\n"
+            "                       --queue=priority; LENS is one of\n"
+            "                       'fixed:N', 'uniform:MIN:MAX' or\n"
+            "                       'bimodal:A:B:PROB'; rate=N generates N\n"
+            "                       messages per second in total\n"
+            "  -W, --wal=DIR        log applied messages to DIR and restore\n"
+            "                       the buffers from DIR on the next start\n"
+            "  -w, --wait=STRATEGY  wait for messages with STRATEGY; one of\n"
+            "                       'park' (default), 'spin' or 'poll'\n"
+            "  -X, --pace=PACE      replay the trace at PACE; either 'fast'\n"
+            "                       (default) or 'recorded'\n"
+            "  -Y, --replay=FILE    read messages from the trace FILE\n"
+            "  -h, --help           print this help and exit\n",
+            progname, DEV_URANDOM);
+}
+
+static int
+parse_ulong(const char* str, unsigned long min, unsigned long max,
+            unsigned long* value)
+{
+    char* end;
+
+    errno = 0;
+    unsigned long res = strtoul(str, &end, 0);
+    if (errno || (end == str) || *end || (res < min) || (res > max)) {
+        return -1;
+    }
+    *value = res;
+
+    return 0;
+}
+
+/* Allocates an array of `n` elements with the given alignment. Each
+ * element's size has to be a multiple of the alignment. */
+static void*
+alloc_aligned_array(size_t n, size_t size, size_t align)
+{
+    void* mem = aligned_alloc(align, n * size);
+    if (!mem) {
+        perror("aligned_alloc");
+        return NULL;
+    }
+    return mem;
+}
+
+/* Buffers are mapped, but not touched. The first write from the owning
+ * processing thread allocates the pages on that thread's NUMA node. */
+static struct data_buf*
+map_data_bufs(size_t nbufs)
+{
+    void* mem = mmap(NULL, nbufs * sizeof(struct data_buf),
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return mem;
+}
+
+/* Joins each of the `n` threads. Returns 0 on success, or -1 on
+ * errors. */
+static int
+join_threads(pthread_t* thread, size_t n)
+{
+    int res = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        int err = pthread_join(thread[i], NULL);
+        if (err) {
+            errno = err;
+            perror("pthread_join");
+            res = -1;
+        }
+    }
+
+    return res;
+}
+
+/* Stops the input threads first, so that none of them waits for room
+ * in a queue that is no longer drained. Then stops the processing
+ * threads. Returns 0 on success, or -1 on errors. */
+static int
+stop_threads(atomic_bool* in_stop, pthread_t* in_thread, size_t nin_threads,
+             struct pipeline* pipe, pthread_t* proc_thread)
+{
+    atomic_store_explicit(in_stop, true, memory_order_release);
+    int res = join_threads(in_thread, nin_threads);
+
+    pipeline_stop(pipe);
+    res |= join_threads(proc_thread, pipe->nprocs);
+
+    return res;
+}
 
 int
 main(int argc, char* argv[])
 {
-    /* Data buffers */
-    {
-        struct data_buf* beg = g_data_buf;
-        struct data_buf* end = g_data_buf + 4;
+    static const struct option long_options[] = {
+        {"aging",      required_argument, NULL, 'e'},
+        {"batch-size", required_argument, NULL, 'b'},
+        {"buffers",    required_argument, NULL, 'B'},
+        {"capacity",   required_argument, NULL, 'r'},
+        {"checkpoint-secs", required_argument, NULL, 'k'},
+        {"count",      required_argument, NULL, 'n'},
+        {"drain-size", required_argument, NULL, 'd'},
+        {"generate",   required_argument, NULL, 'u'},
+        {"duration",   required_argument, NULL, 't'},
+        {"group-bytes", required_argument, NULL, 'G'},
+        {"group-usecs", required_argument, NULL, 'g'},
+        {"headless",   no_argument,       NULL, 'H'},
+        {"in-cpus",    required_argument, NULL, 'c'},
+        {"in-threads", required_argument, NULL, 'I'},
+        {"input",      required_argument, NULL, 'i'},
+        {"mmap",       no_argument,       NULL, 'm'},
+        {"overflow",   required_argument, NULL, 'o'},
+        {"pace",       required_argument, NULL, 'X'},
+        {"persist",    required_argument, NULL, 'p'},
+        {"proc-cpus",  required_argument, NULL, 'C'},
+        {"proc-threads", required_argument, NULL, 'P'},
+        {"queue",      required_argument, NULL, 'q'},
+        {"queues",     required_argument, NULL, 'Q'},
+        {"rate",       required_argument, NULL, 'a'},
+        {"record",     required_argument, NULL, 'R'},
+        {"record-times", no_argument,     NULL, 'T'},
+        {"replay",     required_argument, NULL, 'Y'},
+        {"spin-usecs", required_argument, NULL, 's'},
+        {"steal",      no_argument,       NULL, 'S'},
+        {"wait",       required_argument, NULL, 'w'},
+        {"wal",        required_argument, NULL, 'W'},
+        {"help",       no_argument,       NULL, 'h'},
+        {NULL,         0,                 NULL,  0 }
+    };
+
+    struct in_config in_config = {
+        .filename = DEV_URANDOM,
+        .source = IN_SOURCE_READ,
+        .batch_size = 1,
+        .rate = 0,
+        .replay = false,
+        .pace = IN_PACE_FAST,
+        .record = NULL
+    };
+
+    gen_config_init(&in_config.gen);
+
+    /* Set to stop the input threads */
+    atomic_bool in_stop;
+    atomic_init(&in_stop, false);
+    in_config.stop = &in_stop;
+    bool generate = false;
+    bool rate_set = false;
+
+    bool headless = false;
+
+    const char* store_filename = NULL;
 
-        for (struct data_buf* buf = beg; buf < end; ++buf) {
-            data_buf_init(buf);
+    const char* record_filename = NULL;
+    bool record_times = false;
+
+    struct wal_config wal_config = {
+        .dirname = NULL,
+        .sync_nsecs = 10000000,
+        .sync_bytes = 1ul << 20,
+        .checkpoint_secs = 60
+    };
+
+    struct bench_config bench_config = {
+        .duration_secs = 0,
+        .nmsgs = 0,
+        .priorities = false,
+        .failed = NULL
+    };
+
+    struct proc_config proc_config = {
+        .queue_backend = QUEUE_BACKEND_TXQUEUE,
+        .queue_capacity = 4096,
+        .queue_overflow = QUEUE_OVERFLOW_BLOCK,
+        .queue_aging = 256,
+        .drain_size = 1,
+        .wait = {
+            .strategy = WAIT_PARK,
+            .spin_nsecs = 50000,
+            .timeout_nsecs = 0
+        },
+        .steal = false
+    };
+
+    unsigned long nqueues = 4;
+    unsigned long nbufs = 4;
+    unsigned long nin_threads = 1;
+    unsigned long nproc_threads = 4;
+
+    cpu_set_t* in_cpus = NULL;
+    size_t nin_cpus = 0;
+    cpu_set_t* proc_cpus = NULL;
+    size_t nproc_cpus = 0;
+
+    while (1) {
+        int opt = getopt_long(argc, argv, "a:B:b:C:c:d:e:G:g:HI:i:k:mn:o:P:p:Q:q:R:r:Ss:Tt:u:W:w:X:Y:h",
+                              long_options, NULL);
+        if (opt < 0) {
+            break;
+        }
+        switch (opt) {
+            case 'a': {
+                int res = parse_ulong(optarg, 0, MAX_RATE, &in_config.rate);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid rate '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                rate_set = true;
+                break;
+            }
+            case 'B': {
+                int res = parse_ulong(optarg, 1, MAX_QUEUES, &nbufs);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid number of buffers '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'b': {
+                unsigned long batch_size;
+                int res = parse_ulong(optarg, 1, MAX_BATCH_SIZE, &batch_size);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid batch size '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                in_config.batch_size = batch_size;
+                break;
+            }
+            case 'C': {
+                free(proc_cpus);
+                int res = parse_cpu_sets(optarg, &proc_cpus, &nproc_cpus);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid CPU sets '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'c': {
+                free(in_cpus);
+                int res = parse_cpu_sets(optarg, &in_cpus, &nin_cpus);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid CPU sets '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'd': {
+                unsigned long drain_size;
+                int res = parse_ulong(optarg, 1, MAX_DRAIN_SIZE, &drain_size);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid drain size '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                proc_config.drain_size = drain_size;
+                break;
+            }
+            case 'e': {
+                unsigned long aging;
+                int res = parse_ulong(optarg, 0, MAX_AGING, &aging);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid aging '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                proc_config.queue_aging = aging;
+                break;
+            }
+            case 'G': {
+                unsigned long group_bytes;
+                int res = parse_ulong(optarg, 1, MAX_GROUP_BYTES,
+                                      &group_bytes);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid group-commit size '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                wal_config.sync_bytes = group_bytes;
+                break;
+            }
+            case 'g': {
+                unsigned long group_usecs;
+                int res = parse_ulong(optarg, 1, MAX_GROUP_USECS,
+                                      &group_usecs);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid group-commit interval '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                wal_config.sync_nsecs = group_usecs * 1000ull;
+                break;
+            }
+            case 'H':
+                headless = true;
+                break;
+            case 'I': {
+                int res = parse_ulong(optarg, 1, MAX_THREADS, &nin_threads);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid number of input threads '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'i':
+                in_config.filename = optarg;
+                break;
+            case 'k': {
+                int res = parse_ulong(optarg, 1, MAX_CHECKPOINT_SECS,
+                                      &wal_config.checkpoint_secs);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid checkpoint interval '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'm':
+                in_config.source = IN_SOURCE_MMAP;
+                break;
+            case 'n': {
+                int res = parse_ulong(optarg, 1, ULONG_MAX,
+                                      &bench_config.nmsgs);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid message count '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                headless = true;
+                break;
+            }
+            case 'P': {
+                int res = parse_ulong(optarg, 1, MAX_THREADS, &nproc_threads);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid number of processing threads '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'p':
+                store_filename = optarg;
+                break;
+            case 'Q': {
+                int res = parse_ulong(optarg, 1, MAX_QUEUES, &nqueues);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid number of queues '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'o':
+                if (!strcmp(optarg, "block")) {
+                    proc_config.queue_overflow = QUEUE_OVERFLOW_BLOCK;
+                } else if (!strcmp(optarg, "drop-newest")) {
+                    proc_config.queue_overflow = QUEUE_OVERFLOW_DROP_NEWEST;
+                } else if (!strcmp(optarg, "drop-oldest")) {
+                    proc_config.queue_overflow = QUEUE_OVERFLOW_DROP_OLDEST;
+                } else if (!strcmp(optarg, "coalesce")) {
+                    proc_config.queue_overflow = QUEUE_OVERFLOW_COALESCE;
+                } else {
+                    fprintf(stderr, "%s: invalid overflow policy '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                if (!strcmp(optarg, "txqueue")) {
+                    proc_config.queue_backend = QUEUE_BACKEND_TXQUEUE;
+                } else if (!strcmp(optarg, "ring")) {
+                    proc_config.queue_backend = QUEUE_BACKEND_RING;
+                } else if (!strcmp(optarg, "priority")) {
+                    proc_config.queue_backend = QUEUE_BACKEND_PRIORITY;
+                } else {
+                    fprintf(stderr, "%s: invalid queue backend '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'R':
+                record_filename = optarg;
+                break;
+            case 'r': {
+                unsigned long capacity;
+                int res = parse_ulong(optarg, 1, MAX_QUEUE_CAPACITY,
+                                      &capacity);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid queue capacity '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                proc_config.queue_capacity = capacity;
+                break;
+            }
+            case 's': {
+                unsigned long spin_usecs;
+                int res = parse_ulong(optarg, 0, MAX_SPIN_USECS, &spin_usecs);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid spin time '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                proc_config.wait.spin_nsecs = spin_usecs * 1000;
+                break;
+            }
+            case 'S':
+                proc_config.steal = true;
+                break;
+            case 'T':
+                record_times = true;
+                break;
+            case 't': {
+                int res = parse_ulong(optarg, 1, MAX_DURATION_SECS,
+                                      &bench_config.duration_secs);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid duration '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                headless = true;
+                break;
+            }
+            case 'u': {
+                int res = gen_config_parse(&in_config.gen, optarg);
+                if (res < 0) {
+                    fprintf(stderr, "%s: invalid generator settings '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                generate = true;
+                break;
+            }
+            case 'W':
+                wal_config.dirname = optarg;
+                break;
+            case 'w':
+                if (!strcmp(optarg, "park")) {
+                    proc_config.wait.strategy = WAIT_PARK;
+                } else if (!strcmp(optarg, "spin")) {
+                    proc_config.wait.strategy = WAIT_SPIN;
+                } else if (!strcmp(optarg, "poll")) {
+                    proc_config.wait.strategy = WAIT_POLL;
+                } else {
+                    fprintf(stderr, "%s: invalid wait strategy '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'X':
+                if (!strcmp(optarg, "fast")) {
+                    in_config.pace = IN_PACE_FAST;
+                } else if (!strcmp(optarg, "recorded")) {
+                    in_config.pace = IN_PACE_RECORDED;
+                } else {
+                    fprintf(stderr, "%s: invalid pace '%s'\n",
+                            argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'Y':
+                in_config.filename = optarg;
+                in_config.replay = true;
+                break;
+            case 'h':
+                print_usage(stdout, argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(stderr, argv[0]);
+                return EXIT_FAILURE;
         }
     }
 
-    /* Input thread */
-    pthread_t in_thread;
-    int res = run_in_thread(DEV_URANDOM, g_queue, arraylen(g_queue),
-                            &in_thread);
-    if (res < 0) {
+    /* Select the byte-sum kernel before any thread uses it. */
+    sum_init();
+
+    register_queue_reclaim_hook();
+
+    if (headless) {
+        if (!bench_config.duration_secs && !bench_config.nmsgs) {
+            bench_config.duration_secs = DEFAULT_DURATION_SECS;
+        }
+    }
+
+    if (nproc_threads > nqueues) {
+        fprintf(stderr, "%s: more processing threads than queues\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (nbufs > nqueues) {
+        fprintf(stderr, "%s: more buffers than queues\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (proc_config.queue_backend == QUEUE_BACKEND_PRIORITY) {
+        if (nqueues > MAX_PRIORITY_QUEUES) {
+            fprintf(stderr, "%s: --queue=priority allows at most %lu queues\n",
+                    argv[0], MAX_PRIORITY_QUEUES);
+            return EXIT_FAILURE;
+        }
+        bench_config.priorities = true;
+    }
+    if ((proc_config.queue_overflow == QUEUE_OVERFLOW_COALESCE) &&
+        (proc_config.queue_backend == QUEUE_BACKEND_RING)) {
+        fprintf(stderr, "%s: --overflow=coalesce excludes --queue=ring\n",
+                argv[0]);
         return EXIT_FAILURE;
     }
+    if (generate) {
+        if (in_config.replay || (in_config.source == IN_SOURCE_MMAP)) {
+            fprintf(stderr, "%s: --generate excludes --replay and --mmap\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (in_config.gen.priorities &&
+            (proc_config.queue_backend != QUEUE_BACKEND_PRIORITY)) {
+            fprintf(stderr, "%s: generator priorities require --queue=priority\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (in_config.gen.rate && (in_config.gen.rate < nin_threads)) {
+            fprintf(stderr, "%s: generator rate below number of input threads\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+        in_config.source = IN_SOURCE_GENERATE;
+    }
+    if ((nin_threads > 1) && !generate) {
+        /* Each input thread opens the input on its own. Reads from a
+         * device such as /dev/urandom return different data to each
+         * thread, but each thread would read all of a file. */
+        struct stat st;
+        bool shared = in_config.replay ||
+                      (in_config.source == IN_SOURCE_MMAP) ||
+                      (!stat(in_config.filename, &st) &&
+                       !S_ISCHR(st.st_mode));
+        if (shared) {
+            fprintf(stderr, "%s: several input threads require generated input or a character device\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-    /* Output threads */
+    if (!rate_set) {
+        /* Headless runs measure the pipeline's throughput, and the
+         * arrival times of paced input determine its rate. Otherwise,
+         * read one batch per second, so that the UI can be followed. */
+        bool paced = (in_config.replay &&
+                      (in_config.pace == IN_PACE_RECORDED)) ||
+                     (generate && in_config.gen.rate);
+        if (!headless && !paced) {
+            in_config.rate = in_config.batch_size * nin_threads;
+        }
+    }
+    if (in_config.rate && (in_config.rate < nin_threads)) {
+        fprintf(stderr, "%s: rate below number of input threads\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct trace_writer trace;
+
+    if (record_filename) {
+        int res = trace_writer_open(&trace, record_filename, record_times);
+        if (res < 0) {
+            return EXIT_FAILURE;
+        }
+        in_config.record = &trace;
+    }
+
+    /* Pipeline
+     *
+     * Each processing thread creates its own queues and initializes
+     * its wakeup and buffers after it has been pinned to its CPUs, so
+     * the memory is placed close to the thread. Here we only allocate
+     * the array of queues and map the buffers.
+     */
+
+    struct pipeline pipe = {
+        .nqueues = nqueues,
+        .nbufs = nbufs,
+        .nprocs = nproc_threads
+    };
+
+    pipe.queue = calloc(nqueues, sizeof(*pipe.queue));
+    if (!pipe.queue) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    struct store store;
+
+    if (store_filename) {
+        int res = store_open(&store, store_filename, nbufs);
+        if (res < 0) {
+            return EXIT_FAILURE;
+        }
+        /* The store stays mapped until all threads stopped. */
+        pipe.buf = store.buf;
+        pipe.persistent = true;
+        pipe.restored = store.restored;
+    } else {
+        pipe.buf = map_data_bufs(nbufs);
+        if (!pipe.buf) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct wal wal;
+
+    if (wal_config.dirname) {
+        /* The processing threads replay the log into their buffers. */
+        wal_config.nwriters = nproc_threads;
+        int res = wal_open(&wal, &wal_config, pipe.buf, nbufs);
+        if (res < 0) {
+            return EXIT_FAILURE;
+        }
+        pipe.wal = &wal;
+    }
 
-    pthread_t proc_thread[4];
+    pipe.wakeup = alloc_aligned_array(nproc_threads, sizeof(*pipe.wakeup),
+                                      alignof(struct wakeup));
+    if (!pipe.wakeup) {
+        return EXIT_FAILURE;
+    }
+
+    atomic_init(&pipe.failed, false);
+    atomic_init(&pipe.stopping, false);
+
+    /* If a processing thread fails, the input threads and the
+     * benchmark stop. */
+    in_config.failed = &pipe.failed;
+    bench_config.failed = &pipe.failed;
+
+    int err = pthread_barrier_init(&pipe.ready, NULL, nproc_threads + 1);
+    if (err) {
+        errno = err;
+        perror("pthread_barrier_init");
+        return EXIT_FAILURE;
+    }
+
+    struct proc_stats* proc_stats =
+        alloc_aligned_array(nproc_threads, sizeof(*proc_stats),
+                            alignof(struct proc_stats));
+    if (!proc_stats) {
+        return EXIT_FAILURE;
+    }
+
+    {
+        struct proc_stats* beg = proc_stats;
+        struct proc_stats* end = proc_stats + nproc_threads;
+
+        for (struct proc_stats* stats = beg; stats < end; ++stats) {
+            proc_stats_init(stats);
+        }
+    }
+
+    /* Processing threads */
+
+    pthread_t* proc_thread = calloc(nproc_threads, sizeof(*proc_thread));
+    if (!proc_thread) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
 
     {
         pthread_t* beg = proc_thread;
-        pthread_t* end = proc_thread + 4;
+        pthread_t* end = proc_thread + nproc_threads;
 
         for (pthread_t* thread = beg; thread < end; ++thread) {
-            int res = run_proc_thread(g_queue + (thread - beg),
-                                      g_data_buf + (thread - beg),
+            size_t i = thread - beg;
+            int res = run_proc_thread(&proc_config, &pipe, i,
+                                      proc_stats + i,
+                                      cpu_set_of_thread(proc_cpus,
+                                                        nproc_cpus, i),
                                       thread);
             if (res < 0) {
                 return EXIT_FAILURE;
@@ -78,21 +855,114 @@ main(int argc, char* argv[])
         }
     }
 
-    /* UI */
-    ui_main(g_data_buf, arraylen(g_data_buf));
+    /* Wait until all queues and buffers have been initialized. */
+    pthread_barrier_wait(&pipe.ready);
 
-    /* Clean up */
+    if (atomic_load(&pipe.failed)) {
+        return EXIT_FAILURE;
+    }
+
+    if (pipe.wal) {
+        int res = wal_start(pipe.wal);
+        if (res < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Input threads */
+
+    pthread_t* in_thread = calloc(nin_threads, sizeof(*in_thread));
+    if (!in_thread) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    struct in_stats* in_stats =
+        alloc_aligned_array(nin_threads, sizeof(*in_stats),
+                            alignof(struct in_stats));
+    if (!in_stats) {
+        return EXIT_FAILURE;
+    }
 
-    void* retval;
     {
-        pthread_t* beg = proc_thread;
-        pthread_t* end = proc_thread + 4;
+        struct in_stats* beg = in_stats;
+        struct in_stats* end = in_stats + nin_threads;
+
+        for (struct in_stats* stats = beg; stats < end; ++stats) {
+            in_stats_init(stats);
+        }
+    }
+
+    {
+        pthread_t* beg = in_thread;
+        pthread_t* end = in_thread + nin_threads;
 
         for (pthread_t* thread = beg; thread < end; ++thread) {
-            pthread_join(*thread, &retval);
+            size_t i = thread - beg;
+
+            /* Each thread generates different messages, and each
+             * thread reads at its share of the rates. */
+            struct in_config config = in_config;
+            config.gen.seed += i;
+            config.gen.rate = (config.gen.rate + i) / nin_threads;
+            config.rate = (config.rate + i) / nin_threads;
+
+            int res = run_in_thread(&config, pipe.queue, pipe.nqueues,
+                                    in_stats + i,
+                                    cpu_set_of_thread(in_cpus, nin_cpus, i),
+                                    thread);
+            if (res < 0) {
+                return EXIT_FAILURE;
+            }
         }
     }
-    pthread_join(in_thread, &retval);
+
+    if (headless) {
+        int res = bench_main(&bench_config, in_stats, nin_threads,
+                             proc_stats, nproc_threads);
+        res |= stop_threads(&in_stop, in_thread, nin_threads, &pipe,
+                            proc_thread);
+        if (!res) {
+            print_queue_stats(stdout, pipe.queue, pipe.nqueues);
+        }
+        if (pipe.wal) {
+            res |= wal_close(pipe.wal);
+        }
+        if (pipe.persistent) {
+            store_close(&store);
+        }
+        return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    /* UI */
+    ui_main(&pipe, proc_stats);
+
+    int res = stop_threads(&in_stop, in_thread, nin_threads, &pipe,
+                           proc_thread);
+    if (res < 0) {
+        return EXIT_FAILURE;
+    }
+
+    res = print_latencies(stdout, proc_stats, nproc_threads,
+                          bench_config.priorities);
+    if (res < 0) {
+        return EXIT_FAILURE;
+    }
+
+    print_tx_stats(stdout);
+
+    print_queue_stats(stdout, pipe.queue, pipe.nqueues);
+
+    if (pipe.wal) {
+        res = wal_close(pipe.wal);
+        if (res < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (pipe.persistent) {
+        store_close(&store);
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,98 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct data_buf;
+struct queue;
+struct wakeup;
+struct wal;
+
+/* The pipeline's topology
+ *
+ * The input threads route each message to one of the queues. Messages
+ * from queue `i` are applied to buffer `i % nbufs` by processing
+ * thread `i % nprocs`. Each processing thread owns one wakeup that is
+ * shared by all its queues.
+ *
+ * Processing threads initialize their queues and buffers, so that the
+ * memory gets allocated on the NUMA node of the thread's CPU.
+ */
+struct pipeline {
+    /* Each processing thread creates the queues it serves. */
+    struct queue** queue;
+    size_t nqueues;
+
+    struct data_buf* buf;
+    size_t nbufs;
+
+    /* The buffers are mapped from a store file. Processing threads
+     * flush each buffer after they committed to it. If `restored` is
+     * set, the buffers hold the state of a previous run. */
+    bool persistent;
+    bool restored;
+
+    /* If not NULL, processing threads restore their buffers from the
+     * write-ahead log, and processing transactions append the applied
+     * messages to it. */
+    struct wal* wal;
+
+    struct wakeup* wakeup;
+    size_t nprocs;
+
+    /* Processing threads wait on `ready` after initialization. If
+     * any of them failed to initialize, or later stopped on errors,
+     * `failed` is set. */
+    pthread_barrier_t ready;
+    atomic_bool failed;
+
+    /* Set to stop the processing threads; see pipeline_stop(). */
+    atomic_bool stopping;
+};
+
+static inline size_t
+pipeline_buf_of_queue(const struct pipeline* self, size_t queue)
+{
+    return queue % self->nbufs;
+}
+
+static inline size_t
+pipeline_proc_of_queue(const struct pipeline* self, size_t queue)
+{
+    return queue % self->nprocs;
+}
+
+/* Buffers are initialized by the processing thread of the buffer's
+ * first queue. */
+static inline size_t
+pipeline_proc_of_buf(const struct pipeline* self, size_t buf)
+{
+    return pipeline_proc_of_queue(self, buf);
+}
+
+/* Stops the processing threads after their current drain. The caller
+ * joins the threads afterwards. */
+void
+pipeline_stop(struct pipeline* self);
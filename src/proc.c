@@ -22,116 +22,642 @@
 #include <assert.h>
 #include <errno.h>
 #include <picotm/picotm.h>
+#include <picotm/picotm-tm.h>
 #include <picotm/picotm-tm-ctypes.h>
-#include <picotm/stdbool.h>
+#include <picotm/stddef.h>
 #include <picotm/stdlib.h>
 #include <picotm/string.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include "affinity.h"
 #include "buf.h"
+#include "clock.h"
+#include "pipeline.h"
 #include "ptr.h"
 #include "queue.h"
 #include "recovery.h"
+#include "txstats.h"
+#include "wakeup.h"
+#include "wal.h"
 
-static struct queue_entry*
-queue_entry_of_txqueue_entry_tx(struct txqueue_entry* entry)
+void
+proc_stats_init(struct proc_stats* self)
 {
-    assert(entry);
+    assert(self);
 
-    return containerof(entry, struct queue_entry, entry);
+    atomic_init(&self->ncommits, 0);
+    atomic_init(&self->nentries, 0);
+    atomic_init(&self->nstolen, 0);
+    atomic_init(&self->naborts, 0);
+
+    for (size_t i = 0; i < arraylen(self->latency); ++i) {
+        hist_init(self->latency + i);
+    }
+    for (size_t i = 0; i < arraylen(self->priority_latency); ++i) {
+        hist_init(self->priority_latency + i);
+    }
+}
+
+void
+proc_stats_merge_latency(const struct proc_stats* stats, size_t nstats,
+                         enum proc_latency latency, struct hist* hist)
+{
+    assert(stats || !nstats);
+    assert(latency < NLATENCIES);
+    assert(hist);
+
+    const struct proc_stats* beg = stats;
+    const struct proc_stats* end = stats + nstats;
+
+    for (const struct proc_stats* st = beg; st < end; ++st) {
+        hist_merge(hist, st->latency + latency);
+    }
+}
+
+void
+proc_stats_merge_priority_latency(const struct proc_stats* stats,
+                                  size_t nstats, unsigned int priority,
+                                  struct hist* hist)
+{
+    assert(stats || !nstats);
+    assert(priority < NPRIORITIES);
+    assert(hist);
+
+    const struct proc_stats* beg = stats;
+    const struct proc_stats* end = stats + nstats;
+
+    for (const struct proc_stats* st = beg; st < end; ++st) {
+        hist_merge(hist, st->priority_latency + priority);
+    }
+}
+
+const char*
+proc_latency_name(enum proc_latency latency)
+{
+    static const char* const name[] = {
+        [LATENCY_READ_TO_ENQUEUE] = "read-enqueue",
+        [LATENCY_ENQUEUE_TO_DEQUEUE] = "enqueue-dequeue",
+        [LATENCY_DEQUEUE_TO_APPLY] = "dequeue-apply",
+        [LATENCY_APPLY_TO_COMMIT] = "apply-commit",
+        [LATENCY_END_TO_END] = "end-to-end"
+    };
+    static_assert(arraylen(name) == NLATENCIES,
+                  "number of latency names doesn't match");
+
+    assert(latency < NLATENCIES);
+
+    return name[latency];
+}
+
+/* Times when a message passed the pipeline's stages */
+struct msg_times {
+    unsigned long long read;
+    unsigned long long enqueue;
+    unsigned long long dequeue;
+    unsigned long long apply;
+    unsigned int priority;
+};
+
+/* Per-thread state for draining queues */
+struct drain_state {
+    /* maximum number of messages per transaction */
+    size_t drain_size;
+    /* messages popped from a ring-backed queue */
+    struct queue_entry** entries;
+    /* timestamps of the applied messages */
+    struct msg_times* times;
+    struct proc_stats* stats;
+    /* flush buffers to their file after each commit */
+    bool sync;
+    /* log records of the applied messages, if logging is enabled */
+    struct wal* wal;
+    uint8_t* log;
+};
+
+/* Applies the message from queue `q` to its buffer. With logging enabled, also
+ * writes the message's log record to `state->log + nlog` and returns
+ * the record's size. */
+static size_t
+apply_entry_tx(const struct queue* q, struct data_buf* buf,
+               const struct queue_entry* entry,
+               struct drain_state* state, struct msg_times* times,
+               size_t nlog)
+{
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
+    /* Input threads replace the message of a queued entry when they
+     * coalesce messages, so the entry is read transactionally. */
+    privatize_tx(&entry->msg, hdrlen, PICOTM_TM_PRIVATIZE_LOAD);
+    const uint8_t* msg_buf = load_ptr_tx(&entry->buf);
+
+    /* Copy message buffer into correct field and fill trailing
+     * bytes with 0. */
+    data_buf_write_row_tx(buf, entry->msg.off, msg_buf, entry->msg.len);
+
+    /* Export the message's timestamps for measuring latencies. */
+    store_ullong_tx(&times->apply, monotonic_nsecs());
+    store_ullong_tx(&times->read, load_ullong_tx(&entry->read_tstamp));
+    store_ullong_tx(&times->enqueue,
+                    load_ullong_tx(&entry->enqueue_tstamp));
+    store_uint_tx(&times->priority,
+                  queue_msg_priority(q, entry->msg.queue));
+
+    if (!state->wal) {
+        return 0;
+    }
+    return wal_put_record_tx(state->wal, state->log + nlog, buf,
+                             entry->msg.off, msg_buf, entry->msg.len);
 }
 
+/* Appends the transaction's log records to the log. */
 static void
-proc_main_loop(struct queue* q, struct data_buf* buf)
+log_entries_tx(struct drain_state* state, size_t nlog,
+               size_t* nlogged)
 {
-    assert(q);
-    assert(buf);
+    if (nlog) {
+        wal_append_tx(state->wal, state->log, nlog);
+    }
+    store_size_t_tx(nlogged, nlog);
+}
 
-    int err = pthread_mutex_lock(&q->mutex);
-    if (err) {
-        errno = err;
-        perror("pthread_mutex_lock");
-        return;
+/* Applies up to `drain_size` messages from a transactional or priority
+ * queue within a single transaction. Priority queues return their most
+ * urgent messages first. Returns the number of applied messages,
+ * or -1 on errors.
+ */
+static ssize_t
+drain_txqueue(struct queue* q, struct data_buf* buf,
+              struct drain_state* state, unsigned long* nrestarts,
+              size_t* nlogged)
+{
+    size_t napplied;
+
+    /* Set once the transaction found a message. Restarts keep the
+     * value, so the write is announced only once. */
+    volatile bool writing = false;
+
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
+    picotm_begin
+        tx_site_attempt(&site);
+
+        /* Apply up to `drain_size` messages from the queue. */
+        size_t nlog = 0;
+        size_t i;
+        for (i = 0; i < state->drain_size; ++i) {
+
+            /* Get next message from queue. */
+            struct queue_entry* entry = queue_front_tx(q);
+            if (!entry) {
+                break;
+            }
+
+            if (!writing) {
+                /* Tell snapshot readers that the buffer is being
+                 * modified. Empty drains leave them alone. */
+                data_buf_begin_write(buf);
+                writing = true;
+            }
+
+            store_ullong_tx(&state->times[i].dequeue, monotonic_nsecs());
+
+            nlog += apply_entry_tx(q, buf, entry, state, state->times + i,
+                                   nlog);
+
+            /* Remove message from queue and free memory. */
+            queue_pop_tx(q);
+            destroy_queue_entry_tx(entry);
+        }
+
+        log_entries_tx(state, nlog, nlogged);
+
+        store_size_t_tx(&napplied, i);
+        store_ulong_tx(nrestarts, picotm_number_of_restarts());
+
+    picotm_commit
+        int res = recover_from_tx_error(&site);
+        if (res < 0) {
+            if (writing) {
+                data_buf_end_write(buf);
+            }
+            return -1;
+        }
+        picotm_restart();
+    picotm_end
+
+    if (writing) {
+        data_buf_end_write(buf);
     }
 
-    while (1) {
+    tx_site_commit(&site);
+
+    return napplied;
+}
+
+/* Pops up to `drain_size` messages from a ring-backed queue and
+ * applies them within a single transaction. The messages are removed
+ * from the ring before the transaction starts, so a restarted
+ * transaction applies the same messages again. Returns the number of
+ * applied messages, or -1 on errors.
+ */
+static ssize_t
+drain_ring(struct queue* q, struct data_buf* buf,
+           struct drain_state* state, unsigned long* nrestarts,
+           size_t* nlogged)
+{
+    struct queue_entry** entries = state->entries;
+
+    size_t napplied = 0;
 
-        int err = pthread_cond_wait(&q->cond, &q->mutex);
-        if (err) {
-            errno = err;
-            perror("pthread_cond_wait");
-            goto err_pthread_cond_wait;
+    for (; napplied < state->drain_size; ++napplied) {
+        entries[napplied] = queue_pop(q);
+        if (!entries[napplied]) {
+            break;
         }
+        state->times[napplied].dequeue = monotonic_nsecs();
+    }
 
-        bool continue_loop;
+    if (!napplied) {
+        return 0;
+    }
 
-        do {
+    static struct tx_site site = TX_SITE_INITIALIZER;
 
-            continue_loop = false;
+    data_buf_begin_write(buf);
 
-            picotm_begin
+    picotm_begin
+        tx_site_attempt(&site);
 
-                /* Acquire transactional queue for queue state. */
-                struct txqueue* queue = txqueue_of_state_tx(&q->queue);
+        size_t nlog = 0;
 
-                /* Get next message from queue. */
-                if (txqueue_empty_tx(queue)) {
-                    goto commit;
-                }
-                struct queue_entry* entry =
-                    queue_entry_of_txqueue_entry_tx(txqueue_front_tx(queue));
+        for (size_t i = 0; i < napplied; ++i) {
+            nlog += apply_entry_tx(q, buf, entries[i], state,
+                                   state->times + i, nlog);
+            destroy_queue_entry_tx(entries[i]);
+        }
 
-                /* Copy message buffer into correct field and fill trailing
-                 * bytes with 0. */
-                uint8_t* field = buf->field[entry->msg.off];
-                memcpy_tx(field, entry->msg.buf, entry->msg.len);
-                memset_tx(field + entry->msg.len, 0, 256 - entry->msg.len);
+        log_entries_tx(state, nlog, nlogged);
 
-                /* Remove message from queue and free memory. */
-                txqueue_pop_tx(queue);
-                destroy_queue_entry_tx(entry);
+        store_ulong_tx(nrestarts, picotm_number_of_restarts());
 
-                /* Continue loop until queue runs empty */
-                store_bool_tx(&continue_loop, true);
+    picotm_commit
+        int res = recover_from_tx_error(&site);
+        if (res < 0) {
+            data_buf_end_write(buf);
+            return -1;
+        }
+        picotm_restart();
+    picotm_end
+
+    data_buf_end_write(buf);
 
-            commit:
-            picotm_commit
-                int res = recover_from_tx_error(__FILE__, __LINE__);
-                if (res < 0) {
-                    return;
-                }
-                picotm_restart();
-            picotm_end
+    tx_site_commit(&site);
 
-        } while (continue_loop);
+    return napplied;
+}
+
+/* Applies up to `drain_size` messages from the queue to the buffer.
+ * Returns the number of applied messages, or -1 on errors.
+ */
+static ssize_t
+drain_queue(struct queue* q, struct data_buf* buf, struct drain_state* state)
+{
+    ssize_t napplied = 0;
+    unsigned long nrestarts = 0;
+    size_t nlogged = 0;
+
+    /* The drain functions tell snapshot readers that the buffer is
+     * being modified only if they apply messages. */
+    switch (q->backend) {
+        case QUEUE_BACKEND_TXQUEUE:
+        case QUEUE_BACKEND_PRIORITY:
+            napplied = drain_txqueue(q, buf, state, &nrestarts, &nlogged);
+            break;
+        case QUEUE_BACKEND_RING:
+            /* Entries are popped before the transaction starts. Two
+             * threads that drain the same ring could commit their
+             * entries out of order, so only one at a time does. */
+            if (!queue_try_claim(q)) {
+                break;
+            }
+            napplied = drain_ring(q, buf, state, &nrestarts, &nlogged);
+            queue_unclaim(q);
+            break;
     }
 
-    err = pthread_mutex_unlock(&q->mutex);
-    if (err) {
-        errno = err;
-        perror("pthread_mutex_unlock");
-        abort(); /* abort if cleanup fails */
+    if (napplied <= 0) {
+        return napplied;
     }
 
-    return;
+    /* The entries are gone from the queue, even while we wait for
+     * the messages to become durable. */
+    queue_account_pop(q, napplied);
 
-err_pthread_cond_wait:
-    err = pthread_mutex_unlock(&q->mutex);
-    if (err) {
-        errno = err;
-        perror("pthread_mutex_unlock");
-        abort(); /* abort if cleanup fails */
+    if (state->sync) {
+        int res = data_buf_sync(buf);
+        if (res < 0) {
+            return -1;
+        }
+    }
+
+    if (nlogged) {
+        int res = wal_commit(state->wal, nlogged);
+        if (res < 0) {
+            return -1;
+        }
+    }
+
+    struct proc_stats* stats = state->stats;
+
+    atomic_fetch_add_explicit(&stats->ncommits, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->nentries, napplied,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->naborts, nrestarts,
+                              memory_order_relaxed);
+
+    /* The messages became visible with the commit. */
+    unsigned long long now = monotonic_nsecs();
+
+    for (ssize_t i = 0; i < napplied; ++i) {
+        const struct msg_times* times = state->times + i;
+        hist_add(stats->latency + LATENCY_READ_TO_ENQUEUE,
+                 times->enqueue - times->read);
+        hist_add(stats->latency + LATENCY_ENQUEUE_TO_DEQUEUE,
+                 times->dequeue - times->enqueue);
+        hist_add(stats->latency + LATENCY_DEQUEUE_TO_APPLY,
+                 times->apply - times->dequeue);
+        hist_add(stats->latency + LATENCY_APPLY_TO_COMMIT,
+                 now - times->apply);
+        hist_add(stats->latency + LATENCY_END_TO_END, now - times->read);
+        hist_add(stats->priority_latency + times->priority,
+                 now - times->read);
+    }
+
+    return napplied;
+}
+
+/* Idle processing threads look for other queues with a backlog of
+ * more than STEAL_MIN_BACKLOG_FACTOR * drain size messages. */
+static const size_t STEAL_MIN_BACKLOG_FACTOR = 2;
+
+/* Idle processing threads look for backlogs at least once per
+ * STEAL_INTERVAL_NSECS nanoseconds. */
+static const unsigned long STEAL_INTERVAL_NSECS = 1000000;
+
+/* Returns the index of the queue with the largest backlog, or
+ * `nqueues` if no queue of another thread has enough entries to be
+ * worth stealing. */
+static size_t
+find_victim(struct pipeline* pipe, size_t self, size_t min_backlog)
+{
+    size_t victim = pipe->nqueues;
+    size_t backlog = min_backlog;
+
+    for (size_t i = 0; i < pipe->nqueues; ++i) {
+        if (pipeline_proc_of_queue(pipe, i) == self) {
+            continue;
+        }
+        size_t size = queue_size_hint(pipe->queue[i]);
+        if (size > backlog) {
+            victim = i;
+            backlog = size;
+        }
+    }
+
+    return victim;
+}
+
+/* Applies messages from other threads' queues to their respective
+ * buffers until there's no more backlog, or until the thread's own
+ * queues have been signalled. Each stolen message is written to its
+ * buffer within a transaction, as if its owner thread had applied it.
+ * Returns 0 on success, or -1 on errors.
+ */
+static int
+steal_work(struct pipeline* pipe, size_t self, unsigned int seq,
+           struct drain_state* state)
+{
+    const size_t min_backlog = STEAL_MIN_BACKLOG_FACTOR * state->drain_size;
+
+    while (wakeup_seq(pipe->wakeup + self) == seq) {
+
+        size_t victim = find_victim(pipe, self, min_backlog);
+        if (victim == pipe->nqueues) {
+            break;
+        }
+
+        struct data_buf* buf =
+            pipe->buf + pipeline_buf_of_queue(pipe, victim);
+
+        ssize_t napplied = drain_queue(pipe->queue[victim], buf, state);
+        if (napplied < 0) {
+            return -1;
+        }
+        atomic_fetch_add_explicit(&state->stats->nstolen, napplied,
+                                  memory_order_relaxed);
+    }
+
+    return 0;
+}
+
+/* Drains all queues of the processing thread in a round-robin
+ * fashion. Returns 0 on success, or -1 on errors.
+ */
+static int
+drain_own_queues(struct pipeline* pipe, size_t self,
+                 struct drain_state* state)
+{
+    bool busy;
+
+    do {
+        busy = false;
+
+        for (size_t i = self; i < pipe->nqueues; i += pipe->nprocs) {
+
+            struct data_buf* buf =
+                pipe->buf + pipeline_buf_of_queue(pipe, i);
+
+            ssize_t napplied = drain_queue(pipe->queue[i], buf, state);
+            if (napplied < 0) {
+                return -1;
+            }
+
+            /* Continue loop until all queues run empty */
+            busy |= ((size_t)napplied == state->drain_size);
+        }
+    } while (busy);
+
+    return 0;
+}
+
+/* Applies messages until the pipeline is stopped. Returns 0 on
+ * success, or -1 on errors. */
+static int
+proc_main_loop(const struct proc_config* config, struct pipeline* pipe,
+               size_t self, struct proc_stats* stats)
+{
+    assert(config);
+    assert(pipe);
+    assert(self < pipe->nprocs);
+    assert(stats);
+
+    const size_t drain_size = config->drain_size;
+    assert(drain_size);
+
+    struct wait_config wait = config->wait;
+    if (config->steal && !wait.timeout_nsecs) {
+        /* Wake up periodically to look for backlogs in other
+         * queues. */
+        wait.timeout_nsecs = STEAL_INTERVAL_NSECS;
+    }
+
+    struct drain_state state = {
+        .drain_size = drain_size,
+        .stats = stats,
+        /* With a log, recovery restores the store's rows. */
+        .sync = pipe->persistent && !pipe->wal,
+        .wal = pipe->wal
+    };
+
+    int res = -1;
+
+    state.entries = malloc(drain_size * sizeof(*state.entries));
+    if (!state.entries) {
+        perror("malloc");
+        return -1;
+    }
+
+    state.times = malloc(drain_size * sizeof(*state.times));
+    if (!state.times) {
+        perror("malloc");
+        goto err_malloc_times;
+    }
+
+    state.log = NULL;
+    if (state.wal) {
+        state.log = malloc(drain_size * WAL_MAX_RECORD_SIZE);
+        if (!state.log) {
+            perror("malloc");
+            goto err_malloc_log;
+        }
+    }
+
+    struct wakeup* wakeup = pipe->wakeup + self;
+
+    while (!atomic_load_explicit(&pipe->stopping, memory_order_acquire)) {
+
+        /* Read the wakeup sequence number before looking at the
+         * queues. Messages that arrive after the queues have been
+         * drained advance the sequence number, so they cannot be
+         * missed by wakeup_wait(). */
+        unsigned int seq = wakeup_seq(wakeup);
+
+        int drain_res = drain_own_queues(pipe, self, &state);
+        if (drain_res < 0) {
+            goto err_drain;
+        }
+
+        if (config->steal) {
+            drain_res = steal_work(pipe, self, seq, &state);
+            if (drain_res < 0) {
+                goto err_drain;
+            }
+        }
+
+        wakeup_wait(wakeup, seq, &wait);
+    }
+
+    res = 0;
+
+err_drain:
+    free(state.log);
+err_malloc_log:
+    free(state.times);
+err_malloc_times:
+    free(state.entries);
+    return res;
+}
+
+/* Initializes the thread's wakeup, queues and buffers. The thread
+ * already runs on its CPUs, so the memory gets allocated on the
+ * thread's NUMA node when it's first touched. Buffers restored from a
+ * store or the log are prepared in parallel by their processing
+ * threads. */
+static int
+init_pipeline_stage(const struct proc_config* config, struct pipeline* pipe,
+                    size_t self)
+{
+    wakeup_init(pipe->wakeup + self);
+
+    for (size_t i = self; i < pipe->nqueues; i += pipe->nprocs) {
+        pipe->queue[i] = queue_create(config->queue_backend,
+                                      config->queue_capacity,
+                                      config->queue_overflow,
+                                      config->queue_aging,
+                                      pipe->wakeup + self);
+        if (!pipe->queue[i]) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < pipe->nbufs; ++i) {
+        if (pipeline_proc_of_buf(pipe, i) != self) {
+            continue;
+        }
+        if (!pipe->restored) {
+            data_buf_init(pipe->buf + i);
+        }
+    }
+
+    if (pipe->wal) {
+        /* Buffers are assigned to threads round-robin. */
+        int res = wal_replay(pipe->wal, self, pipe->nprocs);
+        if (res < 0) {
+            return -1;
+        }
+    }
+
+    if (!pipe->restored && !pipe->wal) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < pipe->nbufs; ++i) {
+        if (pipeline_proc_of_buf(pipe, i) != self) {
+            continue;
+        }
+        data_buf_restore(pipe->buf + i);
+    }
+
+    return 0;
+}
+
+void
+pipeline_stop(struct pipeline* self)
+{
+    assert(self);
+
+    atomic_store_explicit(&self->stopping, true, memory_order_release);
+
+    /* Wake up sleeping threads, so they see the flag. */
+    for (size_t i = 0; i < self->nprocs; ++i) {
+        wakeup_signal(self->wakeup + i);
     }
 }
 
 struct proc_main_arg {
-    struct queue* q;
-    struct data_buf* buf;
+    struct proc_config config;
+    struct pipeline* pipe;
+    size_t self;
+    struct proc_stats* stats;
 };
 
 static void
 thread_cleanup(void* arg)
 {
+    flush_queue_entry_outboxes();
+
     picotm_release();
 
     free(arg);
@@ -142,7 +668,22 @@ proc_main(struct proc_main_arg* arg)
 {
     pthread_cleanup_push(thread_cleanup, arg);
 
-    proc_main_loop(arg->q, arg->buf);
+    int res = init_pipeline_stage(&arg->config, arg->pipe, arg->self);
+    if (res < 0) {
+        atomic_store(&arg->pipe->failed, true);
+    }
+
+    /* Wait until all processing threads have been initialized. */
+    pthread_barrier_wait(&arg->pipe->ready);
+
+    if (!res) {
+        res = proc_main_loop(&arg->config, arg->pipe, arg->self, arg->stats);
+        if (res < 0) {
+            /* Nobody drains the thread's queues anymore. Input threads
+             * stop waiting for room, and the benchmark ends. */
+            atomic_store(&arg->pipe->failed, true);
+        }
+    }
 
     pthread_cleanup_pop(1);
 }
@@ -155,37 +696,57 @@ proc_main_cb(void* arg)
 }
 
 int
-run_proc_thread(struct queue* q, struct data_buf* buf, pthread_t* thread)
+run_proc_thread(const struct proc_config* config, struct pipeline* pipe,
+                size_t self, struct proc_stats* stats, const cpu_set_t* cpus,
+                pthread_t* thread)
 {
     struct proc_main_arg* arg = NULL;
 
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
     picotm_begin
+        tx_site_attempt(&site);
+
         struct proc_main_arg* tx_arg = malloc_tx(sizeof(*tx_arg));
-        tx_arg->q = q;
-        tx_arg->buf = buf;
+        memcpy_tx(&tx_arg->config, config, sizeof(tx_arg->config));
+        tx_arg->pipe = pipe;
+        tx_arg->self = self;
+        tx_arg->stats = stats;
 
         store_ptr_tx(&arg, tx_arg);
 
     picotm_commit
-        int res = recover_from_tx_error(__FILE__, __LINE__);
+        int res = recover_from_tx_error(&site);
         if (res < 0) {
             return -1;
         }
         picotm_restart();
     picotm_end
 
+    tx_site_commit(&site);
+
     assert(arg);
 
-    int err = pthread_create(thread, NULL, proc_main_cb, arg);
+    pthread_attr_t attr;
+    int res = init_thread_attr(&attr, cpus);
+    if (res < 0) {
+        goto err_init_thread_attr;
+    }
+
+    int err = pthread_create(thread, &attr, proc_main_cb, arg);
     if (err) {
         errno = err;
         perror("pthread_create");
         goto err_pthread_create;
     }
 
+    pthread_attr_destroy(&attr);
+
     return 0;
 
 err_pthread_create:
+    pthread_attr_destroy(&attr);
+err_init_thread_attr:
     free(arg);
     return -1;
 }
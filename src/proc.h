@@ -21,10 +21,92 @@
 #pragma once
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include "hist.h"
+#include "queue.h"
+#include "wakeup.h"
 
-struct data_buf;
-struct queue;
+struct pipeline;
 
+/* Latencies between the stages of a message's way through the
+ * pipeline. Enqueueing happens within the input transaction, so the
+ * queueing latency includes the rest of that transaction. Applying
+ * happens within the processing transaction, so the commit latency
+ * includes all following messages of the same transaction. */
+enum proc_latency {
+    /* from reading until enqueueing by the input thread */
+    LATENCY_READ_TO_ENQUEUE,
+    /* waiting in the queue */
+    LATENCY_ENQUEUE_TO_DEQUEUE,
+    /* writing the message to its buffer */
+    LATENCY_DEQUEUE_TO_APPLY,
+    /* from applying until the processing transaction committed */
+    LATENCY_APPLY_TO_COMMIT,
+    /* from reading until the processing transaction committed */
+    LATENCY_END_TO_END,
+    NLATENCIES
+};
+
+/* Returns a short name for the latency. */
+const char*
+proc_latency_name(enum proc_latency latency);
+
+/* Statistics of a processing thread; only counts transactions that
+ * applied at least one message. */
+struct proc_stats {
+    alignas(64) atomic_ulong ncommits;
+    atomic_ulong nentries;
+    atomic_ulong nstolen; /* messages taken from other queues */
+    atomic_ulong naborts; /* restarts of committed transactions */
+    /* latencies of applied messages in nanoseconds */
+    struct hist latency[NLATENCIES];
+    /* end-to-end latencies for each message priority */
+    struct hist priority_latency[NPRIORITIES];
+};
+
+void
+proc_stats_init(struct proc_stats* self);
+
+/* Merges the latency histograms of `nstats` processing threads into
+ * `hist`. */
+void
+proc_stats_merge_latency(const struct proc_stats* stats, size_t nstats,
+                         enum proc_latency latency, struct hist* hist);
+
+/* Merges the end-to-end latency histograms of messages with priority
+ * `priority` into `hist`. */
+void
+proc_stats_merge_priority_latency(const struct proc_stats* stats,
+                                  size_t nstats, unsigned int priority,
+                                  struct hist* hist);
+
+struct proc_config {
+    /* backend, capacity and overflow policy of the thread's queues */
+    enum queue_backend queue_backend;
+    size_t queue_capacity;
+    enum queue_overflow queue_overflow;
+    /* delay per level of priority for QUEUE_BACKEND_PRIORITY */
+    unsigned long queue_aging;
+    /* maximum number of messages per transaction */
+    size_t drain_size;
+    /* how to wait for messages on an empty queue */
+    struct wait_config wait;
+    /* apply messages from other queues when idle */
+    bool steal;
+};
+
+/* Starts the processing thread `self` of the pipeline. The thread
+ * initializes its queues and buffers, waits on the pipeline's `ready`
+ * barrier and then applies the messages from its queues. If work
+ * stealing has been enabled, it also applies messages from other
+ * threads' queues. If `cpus` is not NULL, the thread is pinned to the
+ * given CPUs.
+ */
 int
-run_proc_thread(struct queue* q, struct data_buf* buf, pthread_t* thread);
+run_proc_thread(const struct proc_config* config, struct pipeline* pipe,
+                size_t self, struct proc_stats* stats, const cpu_set_t* cpus,
+                pthread_t* thread);
@@ -20,7 +20,433 @@
 
 #include "queue.h"
 #include <assert.h>
+#include <picotm/picotm.h>
+#include <picotm/picotm-tm.h>
+#include <picotm/picotm-tm-ctypes.h>
 #include <picotm/stdlib.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "clock.h"
+#include "ptr.h"
+#include "recovery.h"
+#include "ring.h"
+#include "txstats.h"
+#include "wakeup.h"
+
+/* Each thread that creates queue entries keeps a cache of unused
+ * entries. Entries destroyed by their creator thread go into the
+ * thread's local stack. Entries destroyed by other threads, such as
+ * the processing threads, are returned to the creator's remote stack.
+ * Only the remote stack is shared among threads.
+ *
+ * In the pipeline, the input threads create all entries and the
+ * processing threads destroy them, so nearly every entry returns
+ * through a remote stack. To keep the remote stack's top from becoming
+ * a hotspot, each destroying thread collects the entries of a creator
+ * in an outbox and returns them as a batch of REMOTE_BATCH_SIZE
+ * entries, chained through `batch_next`. The creator moves a batch
+ * into its local stack with a single pop from the remote stack.
+ *
+ * Both stacks are bounded. Entries beyond a stack's limit are freed
+ * instead of being cached.
+ *
+ * All stack and outbox operations are transactional, so entries taken
+ * from or returned to a cache are rolled back if the transaction
+ * aborts.
+ */
+struct queue_entry_cache {
+    struct txstack_state local;
+    unsigned long nlocal;
+
+    struct txstack_state remote;
+    unsigned long nremote; /* entries in all of the remote batches */
+};
+
+/* Upper limit for the number of entries in a thread's local stack */
+static const unsigned long MAX_LOCAL_ENTRIES = 4096;
+
+/* The current limit for the thread's local stack. The limit shrinks
+ * each time the thread runs out of memory. */
+static _Thread_local unsigned long t_max_local = MAX_LOCAL_ENTRIES;
+static _Thread_local unsigned long long t_max_local_nsecs;
+
+/* Upper limit for the number of entries in a remote stack */
+#define MAX_REMOTE_ENTRIES  4096
+
+/* The current limit for all remote stacks. The limit shrinks each
+ * time any thread runs out of memory. */
+static atomic_ulong g_max_remote = ATOMIC_VAR_INIT(MAX_REMOTE_ENTRIES);
+static atomic_ullong g_max_remote_nsecs;
+
+/* While allocations succeed, shrunk limits double at most once per
+ * LIMIT_GROW_NSECS nanoseconds until they reach their maximum. */
+static const unsigned long long LIMIT_GROW_NSECS = 100000000;
+
+/* The cache of the current thread; created on first use. Caches are
+ * never freed, as entries of a terminated thread might still be in
+ * use by other threads. */
+static _Thread_local struct queue_entry_cache* t_cache;
+
+/* Number of entries per batch returned to a remote stack */
+static const unsigned long REMOTE_BATCH_SIZE = 32;
+
+/* Entries destroyed by the current thread on their way back to their
+ * creator. Outboxes are direct-mapped by cache; a creator that maps
+ * to an occupied outbox flushes the outbox's entries first. At most
+ * NOUTBOXES * REMOTE_BATCH_SIZE entries wait in a thread's outboxes.
+ */
+struct queue_entry_outbox {
+    struct queue_entry_cache* cache;
+    struct queue_entry* head;
+    unsigned long nentries;
+};
+
+#define NOUTBOXES   8
+
+static _Thread_local struct queue_entry_outbox t_outbox[NOUTBOXES];
+
+static struct queue_entry_cache*
+get_cache_tx(void)
+{
+    struct queue_entry_cache* cache = load_ptr_tx(&t_cache);
+    if (cache) {
+        return cache;
+    }
+
+    cache = malloc_tx(sizeof(*cache));
+    txstack_state_init(&cache->local);
+    cache->nlocal = 0;
+    txstack_state_init(&cache->remote);
+    cache->nremote = 0;
+
+    store_ptr_tx(&t_cache, cache);
+
+    return cache;
+}
+
+static struct queue_entry*
+queue_entry_of_cache_entry(struct txstack_entry* cache_entry)
+{
+    return containerof(cache_entry, struct queue_entry, cache_entry);
+}
+
+static void
+free_queue_entry_tx(struct queue_entry* entry)
+{
+    txstack_entry_uninit_tm(&entry->cache_entry);
+    free_tx(entry);
+}
+
+/* Frees a batch of entries; returns the number of freed entries. */
+static unsigned long
+free_batch_tx(struct queue_entry* head)
+{
+    unsigned long n = 0;
+
+    while (head) {
+        struct queue_entry* next = load_ptr_tx(&head->batch_next);
+        free_queue_entry_tx(head);
+        head = next;
+        ++n;
+    }
+
+    return n;
+}
+
+static struct queue_entry*
+pop_entry_tx(struct queue_entry_cache* cache)
+{
+    struct txstack* local = txstack_of_state_tx(&cache->local);
+    if (!txstack_empty_tx(local)) {
+        struct queue_entry* entry =
+            queue_entry_of_cache_entry(txstack_top_tx(local));
+        txstack_pop_tx(local);
+        store_ulong_tx(&cache->nlocal, load_ulong_tx(&cache->nlocal) - 1);
+        return entry;
+    }
+
+    struct txstack* remote = txstack_of_state_tx(&cache->remote);
+    if (txstack_empty_tx(remote)) {
+        return NULL;
+    }
+
+    unsigned long nremote = load_ulong_tx(&cache->nremote);
+
+    /* Free batches beyond the limit, which shrinks after a thread ran
+     * out of memory. */
+    unsigned long max_remote = atomic_load_explicit(&g_max_remote,
+                                                    memory_order_relaxed);
+    while ((nremote > max_remote) && !txstack_empty_tx(remote)) {
+        struct queue_entry* head =
+            queue_entry_of_cache_entry(txstack_top_tx(remote));
+        txstack_pop_tx(remote);
+        nremote -= free_batch_tx(head);
+    }
+
+    if (txstack_empty_tx(remote)) {
+        store_ulong_tx(&cache->nremote, 0);
+        return NULL;
+    }
+
+    struct queue_entry* entry =
+        queue_entry_of_cache_entry(txstack_top_tx(remote));
+    txstack_pop_tx(remote);
+    --nremote;
+
+    /* Move the rest of the batch into the local stack, up to the
+     * stack's limit. */
+    unsigned long nlocal = load_ulong_tx(&cache->nlocal);
+    struct queue_entry* next = load_ptr_tx(&entry->batch_next);
+    while (next) {
+        struct queue_entry* tmp = load_ptr_tx(&next->batch_next);
+        if (nlocal < t_max_local) {
+            txstack_push_tx(local, &next->cache_entry);
+            ++nlocal;
+        } else {
+            free_queue_entry_tx(next);
+        }
+        --nremote;
+        next = tmp;
+    }
+    store_ulong_tx(&cache->nlocal, nlocal);
+    store_ulong_tx(&cache->nremote, nremote);
+
+    return entry;
+}
+
+static unsigned long
+grown_limit(unsigned long limit, unsigned long max)
+{
+    return (limit < (max / 2)) ? (limit ? limit * 2 : 1) : max;
+}
+
+/* Restores the limits that shrank after running out of memory. The
+ * timestamps record when each limit changed last. The limits are not
+ * transactional; a restarted transaction merely grows them early. */
+static void
+grow_cache_limits(void)
+{
+    unsigned long max_remote = atomic_load_explicit(&g_max_remote,
+                                                    memory_order_relaxed);
+    if ((t_max_local == MAX_LOCAL_ENTRIES) &&
+        (max_remote == MAX_REMOTE_ENTRIES)) {
+        return;
+    }
+
+    unsigned long long now = monotonic_nsecs();
+
+    if ((t_max_local < MAX_LOCAL_ENTRIES) &&
+        ((now - t_max_local_nsecs) >= LIMIT_GROW_NSECS)) {
+        t_max_local = grown_limit(t_max_local, MAX_LOCAL_ENTRIES);
+        t_max_local_nsecs = now;
+    }
+
+    unsigned long long nsecs =
+        atomic_load_explicit(&g_max_remote_nsecs, memory_order_relaxed);
+
+    if ((max_remote < MAX_REMOTE_ENTRIES) &&
+        ((now - nsecs) >= LIMIT_GROW_NSECS) &&
+        atomic_compare_exchange_strong_explicit(&g_max_remote_nsecs,
+                                                &nsecs, now,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        /* Only one thread grows the limit per interval. A concurrent
+         * shrink wins. */
+        atomic_compare_exchange_strong_explicit(
+            &g_max_remote, &max_remote,
+            grown_limit(max_remote, MAX_REMOTE_ENTRIES),
+            memory_order_relaxed, memory_order_relaxed);
+    }
+}
+
+static struct queue_entry*
+alloc_queue_entry_tx(void)
+{
+    struct queue_entry_cache* cache = get_cache_tx();
+
+    struct queue_entry* entry = pop_entry_tx(cache);
+    if (entry) {
+        return entry;
+    }
+
+    entry = malloc_tx(sizeof(*entry));
+    entry->cache = cache;
+    txstack_entry_init_tm(&entry->cache_entry);
+
+    /* The allocation succeeded, so memory is available again. */
+    grow_cache_limits();
+
+    return entry;
+}
+
+/* Returns the entries of an outbox to the remote stack of their
+ * creator, or frees them if the remote stack is full. */
+static void
+flush_outbox_tx(struct queue_entry_outbox* outbox)
+{
+    struct queue_entry* head = load_ptr_tx(&outbox->head);
+    if (!head) {
+        return;
+    }
+
+    struct queue_entry_cache* cache = load_ptr_tx(&outbox->cache);
+    unsigned long nentries = load_ulong_tx(&outbox->nentries);
+    unsigned long nremote = load_ulong_tx(&cache->nremote);
+    unsigned long max_remote = atomic_load_explicit(&g_max_remote,
+                                                    memory_order_relaxed);
+
+    if ((nremote + nentries) > max_remote) {
+        free_batch_tx(head);
+    } else {
+        struct txstack* remote = txstack_of_state_tx(&cache->remote);
+        txstack_push_tx(remote, &head->cache_entry);
+        store_ulong_tx(&cache->nremote, nremote + nentries);
+    }
+
+    store_ptr_tx(&outbox->head, NULL);
+    store_ulong_tx(&outbox->nentries, 0);
+}
+
+static struct queue_entry_outbox*
+get_outbox_tx(struct queue_entry_cache* cache)
+{
+    struct queue_entry_outbox* outbox =
+        t_outbox + ((uintptr_t)cache / sizeof(*cache)) % NOUTBOXES;
+
+    if (load_ptr_tx(&outbox->cache) != cache) {
+        flush_outbox_tx(outbox);
+        store_ptr_tx(&outbox->cache, cache);
+    }
+
+    return outbox;
+}
+
+static void
+release_queue_entry_tx(struct queue_entry* entry)
+{
+    struct queue_entry_cache* cache = entry->cache;
+
+    if (cache != load_ptr_tx(&t_cache)) {
+        /* Return entry to its creator thread as part of a batch. */
+        struct queue_entry_outbox* outbox = get_outbox_tx(cache);
+        store_ptr_tx(&entry->batch_next, load_ptr_tx(&outbox->head));
+        store_ptr_tx(&outbox->head, entry);
+        unsigned long nentries = load_ulong_tx(&outbox->nentries) + 1;
+        store_ulong_tx(&outbox->nentries, nentries);
+        if (nentries >= REMOTE_BATCH_SIZE) {
+            flush_outbox_tx(outbox);
+        }
+        return;
+    }
+
+    unsigned long nlocal = load_ulong_tx(&cache->nlocal);
+    if (nlocal >= t_max_local) {
+        free_queue_entry_tx(entry);
+        return;
+    }
+
+    struct txstack* local = txstack_of_state_tx(&cache->local);
+    txstack_push_tx(local, &entry->cache_entry);
+    store_ulong_tx(&cache->nlocal, nlocal + 1);
+}
+
+static void
+free_cached_entry(struct txstack_entry* cache_entry, void* data)
+{
+    struct queue_entry* entry = queue_entry_of_cache_entry(cache_entry);
+    txstack_entry_uninit(cache_entry);
+    free(entry);
+}
+
+/* Frees the entries in the calling thread's local stack and outboxes,
+ * and halves the limits of the local and remote stacks. Creators free
+ * the remote batches beyond the new limit when they pop from their
+ * remote stack. Successful allocations restore the limits over time;
+ * see grow_cache_limits(). The hook runs outside of transactions, and no other
+ * thread accesses the local stack or the outboxes, so the entries are
+ * freed without a transaction. */
+static bool
+shrink_queue_entry_cache(void* data)
+{
+    bool reclaimed = false;
+
+    unsigned long max_remote = atomic_load_explicit(&g_max_remote,
+                                                    memory_order_relaxed);
+    while (max_remote &&
+           !atomic_compare_exchange_weak_explicit(&g_max_remote,
+                                                  &max_remote,
+                                                  max_remote / 2,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+        /* another thread changed the limit; retry */
+    }
+    reclaimed |= !!max_remote;
+
+    unsigned long long now = monotonic_nsecs();
+    atomic_store_explicit(&g_max_remote_nsecs, now, memory_order_relaxed);
+
+    reclaimed |= !!t_max_local;
+    t_max_local /= 2;
+    t_max_local_nsecs = now;
+
+    struct queue_entry_cache* cache = t_cache;
+    if (cache && cache->nlocal) {
+        txstack_state_clear_and_uninit_entries(&cache->local,
+                                               free_cached_entry, NULL);
+        cache->nlocal = 0;
+        reclaimed = true;
+    }
+
+    for (size_t i = 0; i < NOUTBOXES; ++i) {
+        struct queue_entry_outbox* outbox = t_outbox + i;
+        struct queue_entry* head = outbox->head;
+        while (head) {
+            struct queue_entry* next = head->batch_next;
+            free_cached_entry(&head->cache_entry, NULL);
+            head = next;
+            reclaimed = true;
+        }
+        outbox->head = NULL;
+        outbox->nentries = 0;
+    }
+
+    return reclaimed;
+}
+
+void
+register_queue_reclaim_hook(void)
+{
+    static struct reclaim_hook hook = {
+        .reclaim = shrink_queue_entry_cache
+    };
+    register_reclaim_hook(&hook);
+}
+
+void
+flush_queue_entry_outboxes(void)
+{
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
+    picotm_begin
+        tx_site_attempt(&site);
+
+        for (size_t i = 0; i < NOUTBOXES; ++i) {
+            flush_outbox_tx(t_outbox + i);
+        }
+    picotm_commit
+        int res = recover_from_tx_error(&site);
+        if (res < 0) {
+            /* Leaking the entries is the only option left. */
+            return;
+        }
+        picotm_restart();
+    picotm_end
+
+    tx_site_commit(&site);
+}
 
 void
 queue_entry_init(struct queue_entry* self)
@@ -28,19 +454,617 @@ queue_entry_init(struct queue_entry* self)
     assert(self);
 
     txqueue_entry_init(&self->entry);
+    txmultiset_entry_init(&self->set_entry);
+    self->buf = self->msg.buf;
+    self->cache = NULL;
+    txstack_entry_init(&self->cache_entry);
+    self->batch_next = NULL;
 }
 
 struct queue_entry*
 create_queue_entry_tx()
 {
-    struct queue_entry* entry = malloc_tx(sizeof(*entry));
+    struct queue_entry* entry = alloc_queue_entry_tx();
+    txqueue_entry_init_tm(&entry->entry);
+    txmultiset_entry_init_tm(&entry->set_entry);
+    store_ptr_tx(&entry->buf, entry->msg.buf);
+    return entry;
+}
+
+struct queue_entry*
+create_queue_entry_with_buf_tx(const uint8_t* buf)
+{
+    struct queue_entry* entry = alloc_queue_entry_tx();
     txqueue_entry_init_tm(&entry->entry);
+    txmultiset_entry_init_tm(&entry->set_entry);
+    store_ptr_tx(&entry->buf, buf);
     return entry;
 }
 
 void
 destroy_queue_entry_tx(struct queue_entry* self)
 {
+    txmultiset_entry_uninit_tm(&self->set_entry);
     txqueue_entry_uninit_tm(&self->entry);
-    free_tx(self);
+    release_queue_entry_tx(self);
+}
+
+/* Coalescing queues track one entry per possible row. */
+#define NROWS (UINT8_MAX + 1)
+
+int
+queue_init(struct queue* self, enum queue_backend backend, size_t capacity,
+           enum queue_overflow overflow, unsigned long aging,
+           struct wakeup* wakeup)
+{
+    assert(self);
+    assert(capacity);
+    assert(wakeup);
+    assert((overflow != QUEUE_OVERFLOW_COALESCE) ||
+           (backend != QUEUE_BACKEND_RING));
+
+    self->wakeup = wakeup;
+    wakeup_init(&self->room);
+
+    self->backend = backend;
+    self->capacity = capacity;
+    self->overflow = overflow;
+    txqueue_state_init(&self->queue);
+    txmultiset_state_init(&self->set);
+    self->aging = aging;
+    self->seq = 0;
+    self->len = 0;
+    atomic_init(&self->size_hint, 0);
+    self->pending = NULL;
+    self->ring = NULL;
+    atomic_flag_clear(&self->claimed);
+
+    atomic_init(&self->max_len, 0);
+    atomic_init(&self->ndropped, 0);
+    atomic_init(&self->ncoalesced, 0);
+    atomic_init(&self->nblocked, 0);
+
+    if (overflow == QUEUE_OVERFLOW_COALESCE) {
+        self->pending = calloc(NROWS, sizeof(*self->pending));
+        if (!self->pending) {
+            perror("calloc");
+            goto err_calloc;
+        }
+    }
+
+    if (backend == QUEUE_BACKEND_RING) {
+        self->ring = ring_create(capacity);
+        if (!self->ring) {
+            perror("ring_create");
+            goto err_ring_create;
+        }
+    }
+
+    return 0;
+
+err_ring_create:
+    free(self->pending);
+err_calloc:
+    txmultiset_state_uninit(&self->set);
+    txqueue_state_uninit(&self->queue);
+    return -1;
+}
+
+void
+queue_uninit(struct queue* self)
+{
+    assert(self);
+
+    ring_destroy(self->ring);
+    free(self->pending);
+    txmultiset_state_uninit(&self->set);
+    txqueue_state_uninit(&self->queue);
+}
+
+struct queue*
+queue_create(enum queue_backend backend, size_t capacity,
+             enum queue_overflow overflow, unsigned long aging,
+             struct wakeup* wakeup)
+{
+    /* The producers' wakeup has its own cache line. */
+    struct queue* self = aligned_alloc(alignof(struct queue), sizeof(*self));
+    if (!self) {
+        perror("aligned_alloc");
+        return NULL;
+    }
+
+    int res = queue_init(self, backend, capacity, overflow, aging, wakeup);
+    if (res < 0) {
+        goto err_queue_init;
+    }
+
+    return self;
+
+err_queue_init:
+    free(self);
+    return NULL;
+}
+
+void
+queue_destroy(struct queue* self)
+{
+    if (!self) {
+        return;
+    }
+    queue_uninit(self);
+    free(self);
+}
+
+size_t
+queue_size_hint(struct queue* self)
+{
+    assert(self);
+
+    switch (self->backend) {
+        case QUEUE_BACKEND_TXQUEUE:
+        case QUEUE_BACKEND_PRIORITY: {
+            long size = atomic_load_explicit(&self->size_hint,
+                                             memory_order_relaxed);
+            return size > 0 ? size : 0;
+        }
+        case QUEUE_BACKEND_RING:
+            return ring_size(self->ring);
+    }
+
+    return 0;
+}
+
+void
+queue_account_push(struct queue* self, size_t n)
+{
+    assert(self);
+
+    atomic_fetch_add_explicit(&self->size_hint, n, memory_order_relaxed);
+}
+
+void
+queue_account_pop(struct queue* self, size_t n)
+{
+    assert(self);
+
+    atomic_fetch_sub_explicit(&self->size_hint, n, memory_order_relaxed);
+
+    /* Ring-backed queues wake up producers when the claim is
+     * released. */
+    if (self->backend != QUEUE_BACKEND_RING) {
+        wakeup_signal(&self->room);
+    }
+}
+
+static void
+account_max_len(struct queue* self, size_t len)
+{
+    unsigned long max_len = atomic_load_explicit(&self->max_len,
+                                                 memory_order_relaxed);
+    while (len > max_len) {
+        bool succ = atomic_compare_exchange_weak_explicit(
+            &self->max_len, &max_len, len, memory_order_relaxed,
+            memory_order_relaxed);
+        if (succ) {
+            break;
+        }
+    }
+}
+
+void
+queue_account_overflow(struct queue* self, size_t len, size_t ndropped,
+                       size_t ncoalesced)
+{
+    assert(self);
+
+    account_max_len(self, len);
+
+    if (ndropped) {
+        atomic_fetch_add_explicit(&self->ndropped, ndropped,
+                                  memory_order_relaxed);
+    }
+    if (ncoalesced) {
+        atomic_fetch_add_explicit(&self->ncoalesced, ncoalesced,
+                                  memory_order_relaxed);
+    }
+}
+
+unsigned int
+queue_msg_priority(const struct queue* self, uint16_t queue)
+{
+    assert(self);
+
+    if (self->backend != QUEUE_BACKEND_PRIORITY) {
+        return 0;
+    }
+    return msg_priority(queue);
+}
+
+void
+queue_signal(struct queue* self)
+{
+    assert(self);
+
+    wakeup_signal(self->wakeup);
+}
+
+/* Producers that wait for room wake up after this time at the latest,
+ * to look at their cancel flag. */
+static const struct wait_config ROOM_WAIT = {
+    .strategy = WAIT_PARK,
+    .timeout_nsecs = 10000000
+};
+
+void
+queue_wait_for_room(struct queue* self, const atomic_bool* cancel)
+{
+    assert(self);
+
+    atomic_fetch_add_explicit(&self->nblocked, 1, memory_order_relaxed);
+
+    while (1) {
+        /* Read the sequence number before looking at the queue's
+         * size, so that pops in between cannot be missed. */
+        unsigned int seq = wakeup_seq(&self->room);
+
+        if (queue_size_hint(self) < self->capacity) {
+            break;
+        }
+        if (cancel && atomic_load_explicit(cancel, memory_order_acquire)) {
+            break;
+        }
+        /* Make sure the processing thread drains the queue while we
+         * sleep. */
+        queue_signal(self);
+        wakeup_wait(&self->room, seq, &ROOM_WAIT);
+    }
+}
+
+static struct queue_entry*
+queue_entry_of_txqueue_entry_tx(struct txqueue_entry* entry)
+{
+    return containerof(entry, struct queue_entry, entry);
+}
+
+static struct queue_entry*
+queue_entry_of_set_entry_tx(struct txmultiset_entry* entry)
+{
+    return containerof(entry, struct queue_entry, set_entry);
+}
+
+static const void*
+deadline_of_set_entry(struct txmultiset_entry* entry)
+{
+    return &queue_entry_of_set_entry_tx(entry)->deadline;
+}
+
+static int
+compare_deadlines(const void* lhs, const void* rhs)
+{
+    unsigned long long lhs_deadline = load_ullong_tx(lhs);
+    unsigned long long rhs_deadline = load_ullong_tx(rhs);
+
+    return (lhs_deadline > rhs_deadline) - (lhs_deadline < rhs_deadline);
+}
+
+static struct txmultiset*
+priority_set_tx(struct queue* self)
+{
+    return txmultiset_of_state_tx(&self->set, deadline_of_set_entry,
+                                  compare_deadlines);
+}
+
+static bool
+is_transactional(const struct queue* self)
+{
+    return self->backend != QUEUE_BACKEND_RING;
+}
+
+struct queue_entry*
+queue_front_tx(struct queue* self)
+{
+    assert(self);
+    assert(is_transactional(self));
+
+    switch (self->backend) {
+        case QUEUE_BACKEND_TXQUEUE: {
+            struct txqueue* queue = txqueue_of_state_tx(&self->queue);
+            if (txqueue_empty_tx(queue)) {
+                return NULL;
+            }
+            return queue_entry_of_txqueue_entry_tx(txqueue_front_tx(queue));
+        }
+        case QUEUE_BACKEND_PRIORITY: {
+            struct txmultiset* set = priority_set_tx(self);
+            if (txmultiset_empty_tx(set)) {
+                return NULL;
+            }
+            return queue_entry_of_set_entry_tx(txmultiset_begin_tx(set));
+        }
+        case QUEUE_BACKEND_RING:
+            break;
+    }
+
+    abort(); /* not reached */
+}
+
+/* Removes an entry from the queue. Entries of a transactional queue
+ * can only be removed from the front. */
+static void
+remove_entry_tx(struct queue* self, struct queue_entry* entry)
+{
+    if (self->pending) {
+        /* Later messages for the entry's row cannot replace it
+         * anymore. */
+        privatize_tx(&entry->msg.off, sizeof(entry->msg.off),
+                     PICOTM_TM_PRIVATIZE_LOAD);
+        struct queue_entry** pending = self->pending + entry->msg.off;
+        if (load_ptr_tx(pending) == entry) {
+            store_ptr_tx(pending, NULL);
+        }
+    }
+
+    switch (self->backend) {
+        case QUEUE_BACKEND_TXQUEUE:
+            txqueue_pop_tx(txqueue_of_state_tx(&self->queue));
+            break;
+        case QUEUE_BACKEND_PRIORITY:
+            txmultiset_erase_tx(priority_set_tx(self), &entry->set_entry);
+            break;
+        case QUEUE_BACKEND_RING:
+            abort(); /* not reached */
+    }
+
+    store_size_t_tx(&self->len, load_size_t_tx(&self->len) - 1);
+}
+
+void
+queue_pop_tx(struct queue* self)
+{
+    assert(self);
+    assert(is_transactional(self));
+
+    remove_entry_tx(self, queue_front_tx(self));
+}
+
+/* Returns the entry that QUEUE_OVERFLOW_DROP_OLDEST discards: the
+ * front of a transactional queue, or the least urgent entry of a
+ * priority queue. */
+static struct queue_entry*
+drop_candidate_tx(struct queue* self)
+{
+    if (self->backend == QUEUE_BACKEND_PRIORITY) {
+        struct txmultiset* set = priority_set_tx(self);
+        return queue_entry_of_set_entry_tx(
+            txmultiset_entry_prev_tx(txmultiset_end_tx(set)));
+    }
+    return queue_front_tx(self);
+}
+
+/* Returns the queued entry for `row` if a message of the given
+ * priority can replace it, or NULL otherwise. Replacing an entry of a
+ * different priority would move the message ahead of or behind its
+ * deadline. */
+static struct queue_entry*
+coalesce_candidate_tx(struct queue* self, unsigned int row,
+                      unsigned int priority)
+{
+    struct queue_entry* entry = load_ptr_tx(self->pending + row);
+    if (!entry || (self->backend != QUEUE_BACKEND_PRIORITY)) {
+        return entry;
+    }
+
+    privatize_tx(&entry->msg.queue, sizeof(entry->msg.queue),
+                 PICOTM_TM_PRIVATIZE_LOAD);
+    if (msg_priority(entry->msg.queue) != priority) {
+        return NULL;
+    }
+    return entry;
+}
+
+enum queue_reserve
+queue_reserve_tx(struct queue* self, unsigned int row, unsigned int priority,
+                 struct queue_entry** entry)
+{
+    assert(self);
+    assert(is_transactional(self));
+    assert(row < NROWS);
+    assert(priority < NPRIORITIES);
+    assert(entry);
+
+    if (load_size_t_tx(&self->len) < self->capacity) {
+        return QUEUE_RESERVED;
+    }
+
+    switch (self->overflow) {
+        case QUEUE_OVERFLOW_BLOCK:
+            return QUEUE_FULL;
+        case QUEUE_OVERFLOW_DROP_NEWEST:
+            return QUEUE_DISCARD;
+        case QUEUE_OVERFLOW_COALESCE:
+            *entry = coalesce_candidate_tx(self, row, priority);
+            if (*entry) {
+                return QUEUE_COALESCE;
+            }
+            /* fall through */
+        case QUEUE_OVERFLOW_DROP_OLDEST: {
+            struct queue_entry* victim = drop_candidate_tx(self);
+            remove_entry_tx(self, victim);
+            destroy_queue_entry_tx(victim);
+            return QUEUE_RESERVED_DROPPED;
+        }
+    }
+
+    abort(); /* not reached */
+}
+
+size_t
+queue_push_tx(struct queue* self, struct queue_entry* entry)
+{
+    assert(self);
+    assert(is_transactional(self));
+    assert(entry);
+
+    /* The producer created the entry; its header is private. */
+
+    switch (self->backend) {
+        case QUEUE_BACKEND_TXQUEUE:
+            txqueue_push_tx(txqueue_of_state_tx(&self->queue), &entry->entry);
+            break;
+        case QUEUE_BACKEND_PRIORITY: {
+            unsigned long long seq = load_ullong_tx(&self->seq);
+            store_ullong_tx(&self->seq, seq + 1);
+            store_ullong_tx(&entry->deadline,
+                            seq + msg_priority(entry->msg.queue) * self->aging);
+            txmultiset_insert_tx(priority_set_tx(self), &entry->set_entry);
+            break;
+        }
+        case QUEUE_BACKEND_RING:
+            abort(); /* not reached */
+    }
+
+    if (self->pending) {
+        store_ptr_tx(self->pending + entry->msg.off, entry);
+    }
+
+    size_t len = load_size_t_tx(&self->len) + 1;
+    store_size_t_tx(&self->len, len);
+
+    return len;
+}
+
+static void
+destroy_dropped_entry(struct queue_entry* entry)
+{
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
+    picotm_begin
+        tx_site_attempt(&site);
+
+        destroy_queue_entry_tx(entry);
+    picotm_commit
+        int res = recover_from_tx_error(&site);
+        if (res < 0) {
+            /* Leaking the entry is the only option left. */
+            return;
+        }
+        picotm_restart();
+    picotm_end
+
+    tx_site_commit(&site);
+}
+
+size_t
+queue_push(struct queue* self, struct queue_entry* entry)
+{
+    assert(self);
+    assert(self->backend == QUEUE_BACKEND_RING);
+
+    size_t ndropped = 0;
+    bool blocked = false;
+
+    while (1) {
+
+        /* See queue_wait_for_room(). */
+        unsigned int seq = wakeup_seq(&self->room);
+
+        if (ring_push(self->ring, entry)) {
+            break;
+        }
+
+        switch (self->overflow) {
+            case QUEUE_OVERFLOW_BLOCK:
+                if (!blocked) {
+                    atomic_fetch_add_explicit(&self->nblocked, 1,
+                                              memory_order_relaxed);
+                    blocked = true;
+                }
+                /* The ring is full; make sure the processing thread
+                 * drains it while we sleep. */
+                queue_signal(self);
+                wakeup_wait(&self->room, seq, &ROOM_WAIT);
+                break;
+            case QUEUE_OVERFLOW_DROP_NEWEST:
+                destroy_dropped_entry(entry);
+                queue_account_overflow(self, self->capacity, 1, 0);
+                return 1;
+            case QUEUE_OVERFLOW_DROP_OLDEST: {
+                /* Only the claiming thread pops entries. A thread that
+                 * drains the ring pops its entries right after taking
+                 * the claim, so retry once it released the claim. */
+                if (!queue_try_claim(self)) {
+                    wakeup_wait(&self->room, seq, &ROOM_WAIT);
+                    break;
+                }
+                /* The processing thread might have drained the ring
+                 * in the meantime. */
+                struct queue_entry* oldest = queue_pop(self);
+                queue_unclaim(self);
+                if (oldest) {
+                    destroy_dropped_entry(oldest);
+                    queue_account_overflow(self, self->capacity, 1, 0);
+                    ++ndropped;
+                }
+                break;
+            }
+            case QUEUE_OVERFLOW_COALESCE:
+                abort(); /* rejected by queue_init() */
+        }
+    }
+
+    account_max_len(self, ring_size(self->ring));
+
+    return ndropped;
+}
+
+bool
+queue_try_claim(struct queue* self)
+{
+    assert(self);
+    assert(self->backend == QUEUE_BACKEND_RING);
+
+    return !atomic_flag_test_and_set_explicit(&self->claimed,
+                                              memory_order_acquire);
+}
+
+void
+queue_unclaim(struct queue* self)
+{
+    assert(self);
+    assert(self->backend == QUEUE_BACKEND_RING);
+
+    atomic_flag_clear_explicit(&self->claimed, memory_order_release);
+
+    wakeup_signal(&self->room);
+}
+
+struct queue_entry*
+queue_pop(struct queue* self)
+{
+    assert(self);
+    assert(self->backend == QUEUE_BACKEND_RING);
+
+    return ring_pop(self->ring);
+}
+
+void
+print_queue_stats(FILE* stream, struct queue* const* queues, size_t nqueues)
+{
+    assert(stream);
+    assert(queues || !nqueues);
+
+    fprintf(stream, "Queues:\n");
+    fprintf(stream, "  %-8s %10s %10s %10s %10s %10s\n",
+            "queue", "capacity", "max len", "dropped", "coalesced",
+            "blocked");
+
+    for (size_t i = 0; i < nqueues; ++i) {
+        const struct queue* q = queues[i];
+        fprintf(stream, "  %-8zu %10zu %10lu %10lu %10lu %10lu\n",
+                i, q->capacity,
+                atomic_load_explicit(&q->max_len, memory_order_relaxed),
+                atomic_load_explicit(&q->ndropped, memory_order_relaxed),
+                atomic_load_explicit(&q->ncoalesced, memory_order_relaxed),
+                atomic_load_explicit(&q->nblocked, memory_order_relaxed));
+    }
 }
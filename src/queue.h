@@ -20,35 +20,287 @@
 
 #pragma once
 
+#include <picotm/picotm-txmultiset.h>
 #include <picotm/picotm-txqueue.h>
-#include <pthread.h>
+#include <picotm/picotm-txstack.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include "data.h"
+#include "wakeup.h"
+
+struct queue_entry_cache;
 
 struct queue_entry {
     struct txqueue_entry entry;
+
+    /* QUEUE_BACKEND_PRIORITY orders entries by their deadline. */
+    struct txmultiset_entry set_entry;
+    unsigned long long deadline;
+
+    /* The message payload; either `msg.buf` or external memory. */
+    const uint8_t* buf;
+
+    /* Entries are recycled through the cache of the thread that
+     * allocated them. While an entry is unused, it's linked into one
+     * of the cache's stacks. Entries that return from other threads
+     * are chained into batches. */
+    struct queue_entry_cache* cache;
+    struct txstack_entry cache_entry;
+    struct queue_entry* batch_next;
+
+    /* Times when the input thread read and enqueued the message */
+    unsigned long long read_tstamp;
+    unsigned long long enqueue_tstamp;
+
     struct hdr msg;
 };
 
+/* Registers a reclaim hook that frees the cached entries of a thread
+ * that ran out of memory and lowers the limits of all entry caches. */
+void
+register_queue_reclaim_hook(void);
+
+/* Returns the entries that the calling thread destroyed, but has not
+ * yet returned to their creators. Threads that destroy entries call
+ * this before they exit. Must be called outside of transactions. */
+void
+flush_queue_entry_outboxes(void);
+
 void
 queue_entry_init(struct queue_entry* self);
 
 struct queue_entry*
 create_queue_entry_tx(void);
 
+/* Creates a queue entry that refers to the message payload in `buf`
+ * instead of storing a copy. The payload has to stay valid until the
+ * entry has been destroyed. The entry's `msg.buf` remains unused.
+ */
+struct queue_entry*
+create_queue_entry_with_buf_tx(const uint8_t* buf);
+
 void
 destroy_queue_entry_tx(struct queue_entry* entry);
 
+enum queue_backend {
+    /* picotm's transactional queue */
+    QUEUE_BACKEND_TXQUEUE,
+    /* Lock-free ring; entries are pushed and popped outside of
+     * transactions. */
+    QUEUE_BACKEND_RING,
+    /* picotm's transactional multiset, ordered by the messages'
+     * priorities */
+    QUEUE_BACKEND_PRIORITY
+};
+
+/* What producers do with a message for a full queue */
+enum queue_overflow {
+    /* Wait until the processing thread made room. */
+    QUEUE_OVERFLOW_BLOCK,
+    /* Discard the new message. */
+    QUEUE_OVERFLOW_DROP_NEWEST,
+    /* Discard the message at the front of the queue; or the least
+     * urgent message of a priority queue. */
+    QUEUE_OVERFLOW_DROP_OLDEST,
+    /* Replace a queued message for the same row, or else discard the
+     * message as with QUEUE_OVERFLOW_DROP_OLDEST. The replacement
+     * keeps its place in the queue. Requires a transactional
+     * backend. */
+    QUEUE_OVERFLOW_COALESCE
+};
+
+struct ring;
+
+struct wakeup;
+
 struct queue {
 
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
+    /* Wakes up the processing thread that serves the queue. Queues
+     * served by the same thread share a wakeup. */
+    struct wakeup* wakeup;
+
+    /* Wakes up producers that wait for room in the full queue.
+     * Consumers signal it after they popped entries. */
+    struct wakeup room;
+
+    enum queue_backend backend;
+
+    size_t capacity;
+    enum queue_overflow overflow;
 
+    /* QUEUE_BACKEND_TXQUEUE */
     struct txqueue_state queue;
+
+    /* QUEUE_BACKEND_PRIORITY: each entry's deadline is the number of
+     * earlier entries, plus `aging` for each level of priority below
+     * the most urgent. Entries are applied in order of their
+     * deadlines. So more urgent entries overtake less urgent ones, but
+     * each entry is overtaken by at most `aging` later entries per
+     * level. */
+    struct txmultiset_state set;
+    unsigned long aging;
+    unsigned long long seq; /* accessed transactionally */
+
+    /* QUEUE_BACKEND_TXQUEUE and QUEUE_BACKEND_PRIORITY */
+
+    /* Number of entries; accessed transactionally. */
+    size_t len;
+    /* Number of entries as accounted after each commit; may be off
+     * temporarily, or even negative. */
+    atomic_long size_hint;
+    /* QUEUE_OVERFLOW_COALESCE: the latest queued entry for each row,
+     * or NULL; accessed transactionally. */
+    struct queue_entry** pending;
+
+    /* QUEUE_BACKEND_RING */
+    struct ring* ring;
+    /* Set while a thread pops and applies the ring's entries */
+    atomic_flag claimed;
+
+    /* Overflow statistics */
+    atomic_ulong max_len;
+    atomic_ulong ndropped;
+    atomic_ulong ncoalesced;
+    atomic_ulong nblocked;
 };
 
-#define QUEUE_INITIALIZER(_queue)                   \
-    {                                               \
-        PTHREAD_MUTEX_INITIALIZER,                  \
-        PTHREAD_COND_INITIALIZER,                   \
-        TXQUEUE_STATE_INITIALIZER((_queue).queue)   \
-    }
+/* Initializes a queue that holds up to `capacity` entries. Producers
+ * handle further messages according to `overflow`, and signal `wakeup`
+ * to wake up the queue's processing thread. Priority queues delay
+ * entries by `aging` entries per level of priority.
+ */
+int
+queue_init(struct queue* self, enum queue_backend backend, size_t capacity,
+           enum queue_overflow overflow, unsigned long aging,
+           struct wakeup* wakeup);
+
+void
+queue_uninit(struct queue* self);
+
+/* Allocates and initializes a queue; see queue_init(). The memory is
+ * allocated and first written by the calling thread, so processing
+ * threads create the queues they serve. */
+struct queue*
+queue_create(enum queue_backend backend, size_t capacity,
+             enum queue_overflow overflow, unsigned long aging,
+             struct wakeup* wakeup);
+
+void
+queue_destroy(struct queue* self);
+
+/* Returns the priority of a message with the header field `queue`.
+ * Only priority queues take the field's upper bits as the priority;
+ * messages of other queues all have priority 0. */
+unsigned int
+queue_msg_priority(const struct queue* self, uint16_t queue);
+
+/* Wakes up the queue's processing thread. Producers call this after
+ * the transaction that filled an empty queue committed. The call is
+ * cheap if no thread is waiting. The processing thread reads its
+ * wakeup's sequence number before checking its queues.
+ */
+void
+queue_signal(struct queue* self);
+
+/* Returns the approximate number of entries in the queue, without
+ * starting a transaction. */
+size_t
+queue_size_hint(struct queue* self);
+
+/* Accounts for `n` entries pushed to or popped from a transactional
+ * queue. Must be called after the transaction committed. Popping wakes
+ * up producers that wait for room. */
+void
+queue_account_push(struct queue* self, size_t n);
+
+void
+queue_account_pop(struct queue* self, size_t n);
+
+/* Accounts for overflow handling in a committed transaction. `len` is
+ * the largest length of the queue that the transaction observed. */
+void
+queue_account_overflow(struct queue* self, size_t len, size_t ndropped,
+                       size_t ncoalesced);
+
+/* Waits until a full queue has room for another entry, or until
+ * `cancel` has been set. Producers call this after the transaction that
+ * found the queue full committed. The producer sleeps until a consumer
+ * popped entries, but looks at `cancel` periodically. `cancel` may be
+ * NULL. Must be called outside of transactions.
+ */
+void
+queue_wait_for_room(struct queue* self, const atomic_bool* cancel);
+
+/* The outcome of queue_reserve_tx() */
+enum queue_reserve {
+    /* The queue has room for the message. */
+    QUEUE_RESERVED,
+    /* The queue dropped its oldest entry to make room. */
+    QUEUE_RESERVED_DROPPED,
+    /* The message has to wait for room. */
+    QUEUE_FULL,
+    /* The message has to be discarded. */
+    QUEUE_DISCARD,
+    /* The message replaces the returned entry. */
+    QUEUE_COALESCE
+};
+
+/* Makes room in a transactional or priority queue for a message for
+ * `row` with the given priority. For QUEUE_COALESCE, the queued entry
+ * for the row is returned in `entry`. Only entries of the same
+ * priority are replaced.
+ */
+enum queue_reserve
+queue_reserve_tx(struct queue* self, unsigned int row, unsigned int priority,
+                 struct queue_entry** entry);
+
+/* Pushes an entry to a transactional or priority queue. The queue
+ * must have room for the entry. Returns the queue's new length. */
+size_t
+queue_push_tx(struct queue* self, struct queue_entry* entry);
+
+/* Returns the front entry of a transactional queue, or the most urgent
+ * entry of a priority queue. Returns NULL if the queue is empty. */
+struct queue_entry*
+queue_front_tx(struct queue* self);
+
+/* Removes the entry returned by queue_front_tx(). */
+void
+queue_pop_tx(struct queue* self);
+
+/* Pushes an entry to a ring-backed queue. If the ring is full, the
+ * queue's overflow policy decides whether the function waits for free
+ * space, destroys the entry or destroys the ring's oldest entries.
+ * Destroying the oldest entries requires the queue's claim; while
+ * another thread holds it, the function waits for the claim's release.
+ * Returns the number of destroyed entries. Must be called outside of
+ * transactions.
+ */
+size_t
+queue_push(struct queue* self, struct queue_entry* entry);
+
+/* Claims a ring-backed queue for draining. Only the claiming thread
+ * pops and applies the ring's entries, so a queue's entries are
+ * applied in order even while other threads steal from it. Returns
+ * false if another thread holds the claim.
+ */
+bool
+queue_try_claim(struct queue* self);
+
+/* Releases the claim and wakes up producers that wait for room. */
+void
+queue_unclaim(struct queue* self);
+
+/* Pops an entry from a ring-backed queue, or returns NULL if the
+ * queue is empty. The caller holds the queue's claim. Must be called
+ * outside of transactions.
+ */
+struct queue_entry*
+queue_pop(struct queue* self);
+
+/* Prints each queue's capacity, its largest observed length, and the
+ * number of dropped and coalesced messages and of blocked producers to
+ * `stream`. */
+void
+print_queue_stats(FILE* stream, struct queue* const* queues, size_t nqueues);
@@ -0,0 +1,274 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "reader.h"
+#include <assert.h>
+#include <picotm/picotm.h>
+#include <picotm/picotm-tm.h>
+#include <picotm/stddef.h>
+#include <picotm/unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "data.h"
+#include "gen.h"
+#include "ptr.h"
+#include "recovery.h"
+#include "txstats.h"
+
+void
+frame_reader_init(struct frame_reader* self, int fd, bool timed)
+{
+    assert(self);
+
+    /* Only reads from regular files return whatever data exists. If
+     * the type is unknown, assume a stream. */
+    struct stat st;
+    int res = fstat(fd, &st);
+
+    self->fd = fd;
+    self->timed = timed;
+    self->stream = (res < 0) || !S_ISREG(st.st_mode);
+    self->gen = NULL;
+    self->data = self->buf;
+    self->beg = 0;
+    self->end = 0;
+}
+
+void
+frame_reader_init_mapped(struct frame_reader* self, const void* data,
+                         size_t len, bool timed)
+{
+    assert(self);
+    assert(data || !len);
+
+    self->fd = -1;
+    self->timed = timed;
+    self->stream = false;
+    self->gen = NULL;
+    self->data = data;
+    self->beg = 0;
+    self->end = len;
+}
+
+void
+frame_reader_init_generated(struct frame_reader* self,
+                            struct generator* gen)
+{
+    assert(self);
+    assert(gen);
+
+    self->fd = -1;
+    self->timed = gen->config.rate;
+    self->stream = false;
+    self->gen = gen;
+    self->data = self->buf;
+    self->beg = 0;
+    self->end = 0;
+}
+
+/* Moves unconsumed bytes to the front of the buffer. The buffer is
+ * private to the reading thread, so this happens outside of
+ * transactions. A restarted transaction in frame_reader_fill() thus
+ * never sees a buffer that has been moved underneath its offsets. */
+static void
+compact(struct frame_reader* self)
+{
+    memmove(self->buf, self->buf + self->beg, self->end - self->beg);
+    self->end -= self->beg;
+    self->beg = 0;
+}
+
+/* Generating messages has no side effects outside of the reader, so
+ * there's no need for a transaction. */
+static size_t
+fill_generated(struct frame_reader* self, size_t nbytes)
+{
+    if ((self->end - self->beg) >= nbytes) {
+        return self->end - self->beg;
+    }
+
+    compact(self);
+
+    self->end += generator_fill(self->gen, self->buf + self->end,
+                                arraylen(self->buf) - self->end);
+
+    return self->end;
+}
+
+/* Returns true if the bytes from `beg` to `end` start with a complete
+ * message. Called within the transaction that read the bytes. */
+static bool
+has_message_tx(const struct frame_reader* self, size_t beg, size_t end)
+{
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
+    if (self->timed) {
+        beg += sizeof(uint64_t);
+    }
+    if ((end < beg) || ((end - beg) < hdrlen)) {
+        return false;
+    }
+
+    const uint8_t* len = self->buf + beg + offsetof(struct hdr, len);
+    privatize_tx(len, sizeof(*len), PICOTM_TM_PRIVATIZE_LOAD);
+
+    return (end - beg) >= (hdrlen + *len);
+}
+
+ssize_t
+frame_reader_fill(struct frame_reader* self, size_t nbytes)
+{
+    assert(self);
+
+    if (frame_reader_is_mapped(self)) {
+        /* All mapped input is available; there's nothing to read. */
+        return self->end - self->beg;
+    }
+
+    if (nbytes > arraylen(self->buf)) {
+        nbytes = arraylen(self->buf);
+    }
+
+    if (self->gen) {
+        return fill_generated(self, nbytes);
+    }
+
+    if ((self->end - self->beg) >= nbytes) {
+        return self->end - self->beg;
+    }
+
+    compact(self);
+
+    size_t navail;
+
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
+    picotm_begin
+        tx_site_attempt(&site);
+
+        size_t beg = load_size_t_tx(&self->beg);
+        size_t end = load_size_t_tx(&self->end);
+
+        /* Read as much as fits into the buffer. A single read usually
+         * returns data for hundreds of messages. Streams deliver their
+         * data as it arrives, so don't wait for more than a message. */
+        while (((end - beg) < nbytes) &&
+               !(self->stream && has_message_tx(self, beg, end))) {
+            ssize_t len = read_tx(self->fd, self->buf + end,
+                                  arraylen(self->buf) - end);
+            if (!len) {
+                break; /* end of input stream */
+            }
+            end += len;
+        }
+
+        store_size_t_tx(&self->beg, beg);
+        store_size_t_tx(&self->end, end);
+        store_size_t_tx(&navail, end - beg);
+
+    picotm_commit
+        int res = recover_from_tx_error(&site);
+        if (res < 0) {
+            return -1;
+        }
+        picotm_restart();
+    picotm_end
+
+    tx_site_commit(&site);
+
+    return navail;
+}
+
+const uint8_t*
+frame_reader_next_tx(struct frame_reader* self, unsigned long long due)
+{
+    assert(self);
+
+    /* The consumed offset is accessed transactionally, so that an
+     * aborted transaction rolls back its messages. The data is private
+     * to the reading thread and does not change during the
+     * transaction. */
+    size_t beg = load_size_t_tx(&self->beg);
+    size_t end = load_size_t_tx(&self->end);
+
+    if (self->timed) {
+        uint64_t tstamp;
+        if ((end - beg) < sizeof(tstamp)) {
+            return NULL;
+        }
+        privatize_tx(self->data + beg, sizeof(tstamp),
+                     PICOTM_TM_PRIVATIZE_LOAD);
+        memcpy(&tstamp, self->data + beg, sizeof(tstamp));
+        if (tstamp > due) {
+            return NULL;
+        }
+        beg += sizeof(tstamp);
+    }
+
+    const uint8_t* msg = self->data + beg;
+
+    /* The first 4 byte of each message are considered meta data. */
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
+    if ((end - beg) < hdrlen) {
+        return NULL;
+    }
+    privatize_tx(msg, hdrlen, PICOTM_TM_PRIVATIZE_LOAD);
+    size_t len = hdrlen + msg[offsetof(struct hdr, len)];
+    if ((end - beg) < len) {
+        return NULL;
+    }
+    privatize_tx(msg, len, PICOTM_TM_PRIVATIZE_LOAD);
+
+    store_size_t_tx(&self->beg, beg + len);
+
+    return msg;
+}
+
+void
+frame_reader_unread_tx(struct frame_reader* self, const uint8_t* msg)
+{
+    assert(self);
+    assert(msg);
+
+    size_t beg = msg - self->data;
+    if (self->timed) {
+        beg -= sizeof(uint64_t);
+    }
+    store_size_t_tx(&self->beg, beg);
+}
+
+int
+frame_reader_peek_tstamp(const struct frame_reader* self,
+                         unsigned long long* tstamp)
+{
+    assert(self);
+    assert(self->timed);
+    assert(tstamp);
+
+    uint64_t value;
+    if ((self->end - self->beg) < sizeof(value)) {
+        return -1;
+    }
+    memcpy(&value, self->data + self->beg, sizeof(value));
+    *tstamp = value;
+
+    return 0;
+}
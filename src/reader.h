@@ -0,0 +1,110 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct generator;
+
+/* The frame reader reads large chunks of the input stream into a
+ * private buffer and parses messages from the buffered data. The
+ * consumed bytes are tracked transactionally, so aborted transactions
+ * return their messages to the buffer.
+ *
+ * Alternatively, the reader parses messages in place from a memory
+ * mapping of the input file.
+ *
+ * Timed input, such as a timed trace, contains the arrival time of
+ * each message as a 64-bit integer before the message.
+ *
+ * Generated input comes from a generator that writes messages into
+ * the buffer without system calls.
+ */
+struct frame_reader {
+    int fd; /* -1 for mapped or generated input */
+    bool timed;
+
+    /* Reads from the input may wait for more data, as with pipes and
+     * FIFOs. */
+    bool stream;
+
+    struct generator* gen; /* NULL for input from a file */
+
+    const uint8_t* data; /* either `buf` or the mapped input */
+
+    size_t beg; /* first unconsumed byte */
+    size_t end; /* end of buffered data */
+
+    uint8_t buf[64 * 1024];
+};
+
+void
+frame_reader_init(struct frame_reader* self, int fd, bool timed);
+
+void
+frame_reader_init_mapped(struct frame_reader* self, const void* data,
+                         size_t len, bool timed);
+
+/* Reads from the generator. Input is timed if the generator has a
+ * rate. */
+void
+frame_reader_init_generated(struct frame_reader* self,
+                            struct generator* gen);
+
+static inline bool
+frame_reader_is_mapped(const struct frame_reader* self)
+{
+    return (self->fd < 0) && !self->gen;
+}
+
+/* Fills the buffer until at least `nbytes` bytes are available, the
+ * buffer is full or the input stream ends. Input from streams is only
+ * read until the buffer holds a complete message, so messages of slow
+ * input don't wait for a whole chunk. Returns the number of buffered
+ * bytes, or -1 on errors. Must be called outside of transactions.
+ */
+ssize_t
+frame_reader_fill(struct frame_reader* self, size_t nbytes);
+
+/* Returns the next message from the buffer, or NULL if no complete
+ * message is available. For timed input, only returns messages that
+ * arrived no later than `due`. The message is not copied. It remains
+ * valid until the next call to frame_reader_fill(); for mapped input,
+ * it remains valid as long as the mapping exists.
+ */
+const uint8_t*
+frame_reader_next_tx(struct frame_reader* self, unsigned long long due);
+
+/* Returns `msg`, the latest message returned by frame_reader_next_tx(),
+ * to the buffer. */
+void
+frame_reader_unread_tx(struct frame_reader* self, const uint8_t* msg);
+
+/* Returns the arrival time of the next message of timed input in
+ * `tstamp`. Returns 0 on success, or -1 if no arrival time is
+ * buffered. Must be called outside of transactions.
+ */
+int
+frame_reader_peek_tstamp(const struct frame_reader* self,
+                         unsigned long long* tstamp);
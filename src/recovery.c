@@ -19,12 +19,18 @@
  */
 
 #include "recovery.h"
+#include <assert.h>
+#include <errno.h>
 #include <picotm/picotm.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "clock.h"
 #include "ptr.h"
+#include "txstats.h"
 
 static void
 print_error_str(const char* file, int line, const char* fmt, ...)
@@ -37,19 +43,120 @@ print_error_str(const char* file, int line, const char* fmt, ...)
     va_end(args);
 }
 
-int
-recover_from_tx_error(const char* file, int line)
+/* Upper limit for restarts of a single transaction */
+static const unsigned long MAX_RESTARTS = 32;
+
+/* Delays before restarting a transaction. Each restart doubles the
+ * delay up to the maximum. */
+static const unsigned long long CONFLICT_BACKOFF_MIN_NSECS = 1000;
+static const unsigned long long CONFLICT_BACKOFF_MAX_NSECS = 1000000;
+static const unsigned long long ENOMEM_BACKOFF_MIN_NSECS = 100000;
+static const unsigned long long ENOMEM_BACKOFF_MAX_NSECS = 100000000;
+
+static pthread_mutex_t g_reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct reclaim_hook* g_reclaim_hooks;
+
+void
+register_reclaim_hook(struct reclaim_hook* hook)
+{
+    assert(hook);
+    assert(hook->reclaim);
+
+    pthread_mutex_lock(&g_reclaim_lock);
+    hook->next = g_reclaim_hooks;
+    g_reclaim_hooks = hook;
+    pthread_mutex_unlock(&g_reclaim_lock);
+}
+
+/* Runs all reclaim hooks. Returns true if any of them might have
+ * released memory. */
+static bool
+reclaim_memory(void)
+{
+    bool reclaimed = false;
+
+    pthread_mutex_lock(&g_reclaim_lock);
+    for (struct reclaim_hook* hook = g_reclaim_hooks; hook;
+                                                      hook = hook->next) {
+        reclaimed |= hook->reclaim(hook->data);
+    }
+    pthread_mutex_unlock(&g_reclaim_lock);
+
+    return reclaimed;
+}
+
+/* Returns a pseudo-random number; xorshift64 with per-thread state. */
+static unsigned long long
+random_ull(void)
+{
+    static _Thread_local unsigned long long t_state;
+
+    if (!t_state) {
+        /* Seed each thread differently; the state must not be 0. */
+        t_state = monotonic_nsecs() | 1;
+    }
+
+    t_state ^= t_state << 13;
+    t_state ^= t_state >> 7;
+    t_state ^= t_state << 17;
+
+    return t_state;
+}
+
+/* Sleeps for a random time between half of the backoff delay and the
+ * full delay. The jitter keeps restarted transactions of different
+ * threads from colliding again. */
+static void
+backoff(unsigned long nrestarts, unsigned long long min_nsecs,
+        unsigned long long max_nsecs)
+{
+    unsigned long long nsecs = min_nsecs;
+    for (unsigned long i = 0; (i < nrestarts) && (nsecs < max_nsecs); ++i) {
+        nsecs *= 2;
+    }
+    if (nsecs > max_nsecs) {
+        nsecs = max_nsecs;
+    }
+
+    nsecs = nsecs / 2 + random_ull() % (nsecs / 2 + 1);
+
+    struct timespec delay = {
+        .tv_sec = nsecs / 1000000000,
+        .tv_nsec = nsecs % 1000000000
+    };
+    while (nanosleep(&delay, &delay) < 0 && errno == EINTR) {
+        /* Continue with remaining time */
+    }
+}
+
+static bool
+is_transient_errno(int errnum)
+{
+    switch (errnum) {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+        case EBUSY:
+        case EINTR:
+        case ENOBUFS:
+        case ENOMEM:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void
+print_error(const struct tx_site* site)
 {
     static const char* const error_string[] = {
         [PICOTM_GENERAL_ERROR] = "General Error",
         [PICOTM_OUT_OF_MEMORY] = "Out Of Memory"
     };
 
-    /* Application-specific error recovery should be implemented here. In
-     * most applications there's a number of recovery strategies for each
-     * error. If all of them fails, the application can at least abort in
-     * a consistent state.
-     */
+    const char* file = site->file;
+    int line = site->line;
 
     switch (picotm_error_status()) {
         case PICOTM_ERROR_CODE:
@@ -67,14 +174,69 @@ recover_from_tx_error(const char* file, int line)
             print_error_str(file, line, "Unknown error.\n");
             break;
     }
+}
+
+int
+recover_from_tx_error(struct tx_site* site)
+{
+    assert(site);
+
+    tx_site_error(site);
 
     if (picotm_error_is_non_recoverable()) {
-        print_error_str(file, line, "Error is non-recoverable. Aborting.\n");
+        print_error(site);
+        print_error_str(site->file, site->line,
+                        "Error is non-recoverable. Aborting.\n");
         abort();
     }
 
-    /* No actual recovery is implemented, so we return -1 to stop the
-     * transaction. A real-world application could run the GC to free up
-     * memory, remove temporary files on the disk, flush caches, etc. */
+    unsigned long nrestarts = tx_site_restarts(site);
+
+    if (nrestarts < MAX_RESTARTS) {
+
+        switch (picotm_error_status()) {
+            case PICOTM_CONFLICTING:
+            case PICOTM_REVOCABLE:
+                /* Another transaction holds the resources; let it
+                 * finish first. */
+                backoff(nrestarts, CONFLICT_BACKOFF_MIN_NSECS,
+                        CONFLICT_BACKOFF_MAX_NSECS);
+                return 0;
+            case PICOTM_ERROR_CODE:
+                if (picotm_error_as_error_code() != PICOTM_OUT_OF_MEMORY) {
+                    break;
+                }
+                /* Release cached memory. Other threads might free memory
+                 * in the meantime, so we wait a bit in any case. */
+                reclaim_memory();
+                backoff(nrestarts, ENOMEM_BACKOFF_MIN_NSECS,
+                        ENOMEM_BACKOFF_MAX_NSECS);
+                return 0;
+            case PICOTM_ERRNO: {
+                int errnum = picotm_error_as_errno();
+                if (!is_transient_errno(errnum)) {
+                    break;
+                }
+                if ((errnum == ENOMEM) || (errnum == ENOBUFS)) {
+                    reclaim_memory();
+                    backoff(nrestarts, ENOMEM_BACKOFF_MIN_NSECS,
+                            ENOMEM_BACKOFF_MAX_NSECS);
+                } else {
+                    backoff(nrestarts, CONFLICT_BACKOFF_MIN_NSECS,
+                            CONFLICT_BACKOFF_MAX_NSECS);
+                }
+                return 0;
+            }
+        }
+    }
+
+    /* The error is permanent, or the transaction failed too often.
+     * We return -1 to stop the transaction. */
+    print_error(site);
+    if (nrestarts >= MAX_RESTARTS) {
+        print_error_str(site->file, site->line,
+                        "Giving up after %lu restarts.\n", nrestarts);
+    }
+    tx_site_failure(site);
     return -1;
 }
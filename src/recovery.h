@@ -20,5 +20,31 @@
 
 #pragma once
 
+#include <stdbool.h>
+
+struct tx_site;
+
+/* A hook that releases memory after a transaction ran out of memory.
+ * Hooks run outside of transactions, in the thread that encountered
+ * the error. The function returns true if it might have released
+ * memory. */
+struct reclaim_hook {
+    bool (*reclaim)(void* data);
+    void* data;
+    struct reclaim_hook* next;
+};
+
+/* Adds a hook to the list of reclaim hooks. The hook has to stay valid
+ * for the lifetime of the program. */
+void
+register_reclaim_hook(struct reclaim_hook* hook);
+
+/* Handles the error of a transaction at `site`. Transient errors,
+ * such as conflicts or a lack of memory, are retried after a
+ * randomized, exponentially growing delay. Out-of-memory errors run
+ * the reclaim hooks first. Returns 0 if the transaction can be
+ * restarted, or -1 if it has to be given up. Transactions are given
+ * up on permanent errors, or after a bounded number of restarts.
+ */
 int
-recover_from_tx_error(const char* file, int line);
+recover_from_tx_error(struct tx_site* site);
@@ -0,0 +1,155 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "ring.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * The ring follows Dmitry Vyukov's bounded MPMC queue. Each slot
+ * carries a sequence number that tells producers and consumers whether
+ * the slot is free for the current lap of the ring.
+ */
+
+struct ring*
+ring_create(size_t capacity)
+{
+    size_t nslots = 1;
+    while (nslots < capacity) {
+        if (nslots > (SIZE_MAX / 2)) {
+            return NULL;
+        }
+        nslots *= 2;
+    }
+
+    size_t size = sizeof(struct ring) + nslots * sizeof(struct ring_slot);
+
+    /* aligned_alloc() requires a multiple of the alignment */
+    size = (size + RING_CACHE_LINE_SIZE - 1) & ~(RING_CACHE_LINE_SIZE - 1);
+
+    struct ring* self = aligned_alloc(RING_CACHE_LINE_SIZE, size);
+    if (!self) {
+        return NULL;
+    }
+
+    atomic_init(&self->head, 0);
+    atomic_init(&self->tail, 0);
+    atomic_init(&self->len, 0);
+    self->mask = nslots - 1;
+    self->capacity = capacity;
+
+    for (size_t i = 0; i < nslots; ++i) {
+        atomic_init(&self->slot[i].seq, i);
+        self->slot[i].item = NULL;
+    }
+
+    return self;
+}
+
+void
+ring_destroy(struct ring* self)
+{
+    free(self);
+}
+
+bool
+ring_push(struct ring* self, void* item)
+{
+    assert(self);
+
+    size_t len = atomic_load_explicit(&self->len, memory_order_relaxed);
+
+    do {
+        if (len >= self->capacity) {
+            return false; /* full */
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&self->len, &len,
+                                                    len + 1,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+
+    size_t pos = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+    while (1) {
+        struct ring_slot* slot = self->slot + (pos & self->mask);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (!dif) {
+            if (atomic_compare_exchange_weak_explicit(&self->head, &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                slot->item = item;
+                atomic_store_explicit(&slot->seq, pos + 1,
+                                      memory_order_release);
+                return true;
+            }
+        } else if (dif < 0) {
+            /* A consumer that popped the slot's previous item has not
+             * released the slot yet. */
+            atomic_fetch_sub_explicit(&self->len, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&self->head, memory_order_relaxed);
+        }
+    }
+}
+
+void*
+ring_pop(struct ring* self)
+{
+    assert(self);
+
+    size_t pos = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    while (1) {
+        struct ring_slot* slot = self->slot + (pos & self->mask);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (!dif) {
+            if (atomic_compare_exchange_weak_explicit(&self->tail, &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                void* item = slot->item;
+                atomic_store_explicit(&slot->seq, pos + self->mask + 1,
+                                      memory_order_release);
+                atomic_fetch_sub_explicit(&self->len, 1,
+                                          memory_order_relaxed);
+                return item;
+            }
+        } else if (dif < 0) {
+            return NULL; /* empty */
+        } else {
+            pos = atomic_load_explicit(&self->tail, memory_order_relaxed);
+        }
+    }
+}
+
+size_t
+ring_size(struct ring* self)
+{
+    assert(self);
+
+    return atomic_load_explicit(&self->len, memory_order_relaxed);
+}
@@ -0,0 +1,72 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RING_CACHE_LINE_SIZE    64
+
+struct ring_slot {
+    atomic_size_t seq;
+    void* item;
+};
+
+/* A bounded, lock-free ring buffer of pointers. Any number of threads
+ * can push and pop concurrently. The ring is not transactional; its
+ * operations take effect immediately and cannot be rolled back.
+ *
+ * Producer and consumer positions are kept in separate cache lines.
+ * The number of slots is a power of two; producers reserve one of
+ * `capacity` items in `len` before they take a slot, so the ring never
+ * holds more than `capacity` items.
+ */
+struct ring {
+    alignas(RING_CACHE_LINE_SIZE) atomic_size_t head; /* next push */
+    alignas(RING_CACHE_LINE_SIZE) atomic_size_t tail; /* next pop */
+    alignas(RING_CACHE_LINE_SIZE) atomic_size_t len;
+
+    alignas(RING_CACHE_LINE_SIZE) size_t mask;
+    size_t capacity;
+    struct ring_slot slot[];
+};
+
+/* Creates a ring with room for `capacity` items. */
+struct ring*
+ring_create(size_t capacity);
+
+void
+ring_destroy(struct ring* self);
+
+/* Returns false if the ring is full. */
+bool
+ring_push(struct ring* self, void* item);
+
+/* Returns NULL if the ring is empty. */
+void*
+ring_pop(struct ring* self);
+
+/* Returns the number of items in the ring, including items that are
+ * being pushed or popped. */
+size_t
+ring_size(struct ring* self);
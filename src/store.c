@@ -0,0 +1,268 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "store.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "buf.h"
+
+static const char STORE_MAGIC[8] = "PTMDEMO";
+
+/* Incremented whenever the layout of the file or of `struct data_buf`
+ * changes */
+static const uint32_t STORE_VERSION = 1;
+
+/* The buffers start after the header page. */
+static const size_t STORE_DATA_OFFSET = 4096;
+
+struct store_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t buf_size;
+    uint64_t nbufs;
+};
+
+static int
+check_header(const struct store_header* hdr, const char* filename,
+             size_t nbufs)
+{
+    if (memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic))) {
+        fprintf(stderr, "%s: not a picotm-demo store\n", filename);
+        return -1;
+    }
+    if ((hdr->version != STORE_VERSION) ||
+        (hdr->buf_size != sizeof(struct data_buf))) {
+        fprintf(stderr, "%s: unsupported store version\n", filename);
+        return -1;
+    }
+    if (hdr->nbufs != nbufs) {
+        fprintf(stderr, "%s: store holds %llu buffers\n", filename,
+                (unsigned long long)hdr->nbufs);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads and checks the header of an existing store. */
+static int
+read_header(int fd, const char* filename, size_t nbufs)
+{
+    struct store_header hdr;
+
+    ssize_t res = pread(fd, &hdr, sizeof(hdr), 0);
+    if (res < 0) {
+        perror("pread");
+        return -1;
+    } else if ((size_t)res < sizeof(hdr)) {
+        fprintf(stderr, "%s: not a picotm-demo store\n", filename);
+        return -1;
+    }
+
+    return check_header(&hdr, filename, nbufs);
+}
+
+static int
+sync_parent_dir(const char* filename)
+{
+    char* path = strdup(filename);
+    if (!path) {
+        perror("strdup");
+        return -1;
+    }
+
+    int fd = open(dirname(path), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror("open");
+        goto err_open;
+    }
+    int res = fsync(fd);
+    if (res < 0) {
+        perror("fsync");
+        goto err_fsync;
+    }
+
+    close(fd);
+    free(path);
+
+    return 0;
+
+err_fsync:
+    close(fd);
+err_open:
+    free(path);
+    return -1;
+}
+
+/* Creates a store with zeroed buffers in a temporary file and renames
+ * it to `filename`. A crash leaves either no store or a complete one.
+ * Returns the file descriptor, or -1 on errors. */
+static int
+create_store(const char* filename, size_t len, size_t nbufs)
+{
+    char tmp_filename[PATH_MAX];
+    int res = snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp",
+                       filename);
+    if (res >= (int)sizeof(tmp_filename)) {
+        errno = ENAMETOOLONG;
+        perror("snprintf");
+        return -1;
+    }
+
+    int fd = open(tmp_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+
+    res = ftruncate(fd, len);
+    if (res < 0) {
+        perror("ftruncate");
+        goto err;
+    }
+
+    struct store_header hdr = {
+        .version = STORE_VERSION,
+        .buf_size = sizeof(struct data_buf),
+        .nbufs = nbufs
+    };
+    memcpy(hdr.magic, STORE_MAGIC, sizeof(hdr.magic));
+
+    ssize_t len_written = pwrite(fd, &hdr, sizeof(hdr), 0);
+    if (len_written < 0) {
+        perror("pwrite");
+        goto err;
+    } else if ((size_t)len_written < sizeof(hdr)) {
+        fprintf(stderr, "%s: short write\n", tmp_filename);
+        goto err;
+    }
+
+    res = fsync(fd);
+    if (res < 0) {
+        perror("fsync");
+        goto err;
+    }
+
+    res = rename(tmp_filename, filename);
+    if (res < 0) {
+        perror("rename");
+        goto err;
+    }
+
+    res = sync_parent_dir(filename);
+    if (res < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+
+err:
+    close(fd);
+    unlink(tmp_filename);
+    return -1;
+}
+
+int
+store_open(struct store* self, const char* filename, size_t nbufs)
+{
+    assert(self);
+    assert(filename);
+
+    self->len = STORE_DATA_OFFSET + nbufs * sizeof(struct data_buf);
+
+    self->fd = open(filename, O_RDWR);
+    if (self->fd < 0 && errno != ENOENT) {
+        perror("open");
+        return -1;
+    }
+
+    struct stat st = {
+        .st_size = 0
+    };
+
+    if (self->fd >= 0) {
+        int res = fstat(self->fd, &st);
+        if (res < 0) {
+            perror("fstat");
+            goto err_fstat;
+        }
+    }
+
+    self->restored = st.st_size > 0;
+
+    if (self->restored) {
+        /* Never touch a file that isn't a store of the right layout. */
+        int res = read_header(self->fd, filename, nbufs);
+        if (res < 0) {
+            goto err_read_header;
+        }
+        if ((size_t)st.st_size != self->len) {
+            fprintf(stderr, "%s: store has wrong size\n", filename);
+            goto err_size;
+        }
+    } else {
+        /* Only a missing or empty file becomes a new store. */
+        if (self->fd >= 0) {
+            close(self->fd);
+        }
+        self->fd = create_store(filename, self->len, nbufs);
+        if (self->fd < 0) {
+            return -1;
+        }
+    }
+
+    self->mem = mmap(NULL, self->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     self->fd, 0);
+    if (self->mem == MAP_FAILED) {
+        perror("mmap");
+        goto err_mmap;
+    }
+
+    self->buf = (struct data_buf*)((uint8_t*)self->mem + STORE_DATA_OFFSET);
+    self->nbufs = nbufs;
+
+    return 0;
+
+err_mmap:
+err_size:
+err_read_header:
+err_fstat:
+    close(self->fd);
+    return -1;
+}
+
+void
+store_close(struct store* self)
+{
+    assert(self);
+
+    munmap(self->mem, self->len);
+    close(self->fd);
+}
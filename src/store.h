@@ -0,0 +1,60 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct data_buf;
+
+/* A file that holds the pipeline's buffers
+ *
+ * The file starts with a header page, followed by the buffers. The
+ * buffers are mapped into memory with MAP_SHARED, so committed writes
+ * end up in the file. Processing threads flush each buffer after they
+ * committed to it; see `data_buf_sync()`. picotm writes the rows in
+ * place, and the kernel writes pages back at any time, so commits are
+ * not atomic on disk. After a crash, rows can hold parts of different
+ * commits; only the write-ahead log restores a consistent state.
+ */
+struct store {
+    int fd;
+    void* mem;
+    size_t len;
+
+    struct data_buf* buf;
+    size_t nbufs;
+
+    /* The file held buffers of a previous run. */
+    bool restored;
+};
+
+/* Opens or creates the store at `filename` with `nbufs` buffers. An
+ * existing store has to contain the same number of buffers. Only a
+ * missing or empty file is initialized as a new store; other files
+ * without a valid header are rejected and left unchanged. Returns 0 on
+ * success, or -1 on errors.
+ */
+int
+store_open(struct store* self, const char* filename, size_t nbufs);
+
+void
+store_close(struct store* self);
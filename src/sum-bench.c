@@ -0,0 +1,119 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * A microbenchmark for the byte-sum kernels. For each kernel that the
+ * CPU supports, it measures the time for summing 256-byte rows and for
+ * summing whole data buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "buf.h"
+#include "clock.h"
+#include "ptr.h"
+#include "sum.h"
+
+/* Total number of bytes summed per measurement */
+static const unsigned long long BENCH_BYTES = 1ull << 30;
+
+static struct data_buf g_buf;
+
+/* Sums `len` bytes at `data` repeatedly and prints the throughput.
+ * Returns the sum of the final pass. */
+static unsigned long
+bench_kernel(const struct sum_kernel* kernel, const char* what,
+             const uint8_t* data, size_t len)
+{
+    const unsigned long long niters = BENCH_BYTES / len;
+
+    /* Sums are accumulated and printed, so the compiler cannot drop
+     * the kernel calls. */
+    volatile unsigned long total = 0;
+
+    unsigned long long beg = monotonic_nsecs();
+
+    for (unsigned long long i = 0; i < niters; ++i) {
+        total += kernel->sum(data, len);
+    }
+
+    unsigned long long end = monotonic_nsecs();
+
+    double nsecs = end - beg;
+
+    printf("%-8s %-8s %10.2f ns/call %8.2f GiB/s\n",
+           kernel->name, what, nsecs / niters,
+           (niters * len) / nsecs * 1e9 / (1ull << 30));
+
+    return kernel->sum(data, len);
+}
+
+int
+main(void)
+{
+    sum_init();
+
+    srand(time(NULL));
+
+    uint8_t* beg = g_buf.field[0];
+    uint8_t* end = g_buf.field[0] + sizeof(g_buf.field);
+
+    for (uint8_t* pos = beg; pos < end; ++pos) {
+        *pos = rand();
+    }
+
+    const struct sum_kernel* kernel[8];
+    size_t nkernels = sum_supported_kernels(kernel, arraylen(kernel));
+    if (nkernels > arraylen(kernel)) {
+        nkernels = arraylen(kernel);
+    }
+
+    printf("Selected kernel: %s\n\n", sum_kernel()->name);
+
+    int status = EXIT_SUCCESS;
+
+    /* The scalar kernel comes first and provides the reference sums. */
+    unsigned long row_sum = 0;
+    unsigned long buf_sum = 0;
+
+    for (size_t i = 0; i < nkernels; ++i) {
+        unsigned long sum = bench_kernel(kernel[i], "row", g_buf.field[0],
+                                         sizeof(g_buf.field[0]));
+        if (!i) {
+            row_sum = sum;
+        } else if (sum != row_sum) {
+            fprintf(stderr, "%s: wrong row sum %lu, expected %lu\n",
+                    kernel[i]->name, sum, row_sum);
+            status = EXIT_FAILURE;
+        }
+
+        sum = bench_kernel(kernel[i], "buffer", g_buf.field[0],
+                           sizeof(g_buf.field));
+        if (!i) {
+            buf_sum = sum;
+        } else if (sum != buf_sum) {
+            fprintf(stderr, "%s: wrong buffer sum %lu, expected %lu\n",
+                    kernel[i]->name, sum, buf_sum);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    return status;
+}
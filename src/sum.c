@@ -0,0 +1,175 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sum.h"
+#include <assert.h>
+#include <stdbool.h>
+#include "ptr.h"
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+static unsigned long
+scalar_sum(const uint8_t* data, size_t len)
+{
+    unsigned long sum = 0;
+
+    const uint8_t* beg = data;
+    const uint8_t* end = data + len;
+
+    for (const uint8_t* pos = beg; pos < end; ++pos) {
+        sum += *pos;
+    }
+
+    return sum;
+}
+
+#if defined HAVE_X86_KERNELS
+
+/*
+ * The x86 kernels use the PSADBW instruction, which computes the sum
+ * of absolute differences of 8 unsigned bytes. Against a zero vector,
+ * that's the sum of the bytes in each 64-bit lane. The kernels are
+ * compiled for their instruction set via function attributes, so the
+ * rest of the program doesn't depend on it.
+ */
+
+__attribute__((target("sse2")))
+static unsigned long
+sse2_sum(const uint8_t* data, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+
+    uint64_t lane[2];
+    _mm_storeu_si128((__m128i*)lane, acc);
+
+    return lane[0] + lane[1] + scalar_sum(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned long
+avx2_sum(const uint8_t* data, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+    }
+
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i*)lane, acc);
+
+    return lane[0] + lane[1] + lane[2] + lane[3] +
+           sse2_sum(data + i, len - i);
+}
+
+static bool
+cpu_supports_sse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool
+cpu_supports_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+static const struct {
+    struct sum_kernel kernel;
+    bool (*supported)(void);
+} g_kernels[] = {
+    {{"scalar", scalar_sum}, NULL},
+#if defined HAVE_X86_KERNELS
+    {{"sse2", sse2_sum}, cpu_supports_sse2},
+    {{"avx2", avx2_sum}, cpu_supports_avx2}
+#endif
+};
+
+static const struct sum_kernel* g_kernel = &g_kernels[0].kernel;
+
+static bool
+kernel_is_supported(size_t i)
+{
+    return !g_kernels[i].supported || g_kernels[i].supported();
+}
+
+void
+sum_init(void)
+{
+#if defined HAVE_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+
+    /* Kernels are sorted from slowest to fastest. */
+    for (size_t i = 0; i < arraylen(g_kernels); ++i) {
+        if (kernel_is_supported(i)) {
+            g_kernel = &g_kernels[i].kernel;
+        }
+    }
+}
+
+const struct sum_kernel*
+sum_kernel(void)
+{
+    return g_kernel;
+}
+
+size_t
+sum_supported_kernels(const struct sum_kernel** kernels, size_t nkernels)
+{
+    assert(kernels || !nkernels);
+
+    size_t n = 0;
+
+    for (size_t i = 0; i < arraylen(g_kernels); ++i) {
+        if (!kernel_is_supported(i)) {
+            continue;
+        }
+        if (n < nkernels) {
+            kernels[n] = &g_kernels[i].kernel;
+        }
+        ++n;
+    }
+
+    return n;
+}
+
+unsigned long
+bytes_sum(const uint8_t* data, size_t len)
+{
+    return g_kernel->sum(data, len);
+}
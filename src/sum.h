@@ -0,0 +1,50 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A kernel that sums a range of bytes */
+struct sum_kernel {
+    const char* name;
+    unsigned long (*sum)(const uint8_t* data, size_t len);
+};
+
+/* Selects the fastest kernel that the CPU supports. Call once at
+ * startup, before any thread sums bytes. Until then, sums are computed
+ * by the scalar kernel. */
+void
+sum_init(void);
+
+/* Returns the selected kernel. */
+const struct sum_kernel*
+sum_kernel(void);
+
+/* Stores up to `nkernels` of the kernels that the CPU supports in
+ * `kernels`, starting with the scalar kernel. Returns the number of
+ * supported kernels. */
+size_t
+sum_supported_kernels(const struct sum_kernel** kernels, size_t nkernels);
+
+/* Returns the sum of `len` bytes at `data`. */
+unsigned long
+bytes_sum(const uint8_t* data, size_t len);
@@ -0,0 +1,131 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "trace.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <picotm/unistd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "clock.h"
+
+static const char TRACE_MAGIC[8] = "PTMDTRC";
+
+/* Incremented whenever the trace format changes */
+static const uint32_t TRACE_VERSION = 1;
+
+int
+trace_writer_open(struct trace_writer* self, const char* filename,
+                  bool timed)
+{
+    assert(self);
+    assert(filename);
+
+    self->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                    0644);
+    if (self->fd < 0) {
+        perror("open");
+        return -1;
+    }
+
+    struct trace_header hdr = {
+        .version = TRACE_VERSION,
+        .flags = timed ? TRACE_TIMED : 0
+    };
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+
+    ssize_t res = write(self->fd, &hdr, sizeof(hdr));
+    if (res < 0) {
+        perror("write");
+        goto err_write;
+    } else if ((size_t)res < sizeof(hdr)) {
+        fprintf(stderr, "%s: short write\n", filename);
+        goto err_write;
+    }
+
+    self->timed = timed;
+    self->start_nsecs = monotonic_nsecs();
+
+    return 0;
+
+err_write:
+    close(self->fd);
+    return -1;
+}
+
+size_t
+trace_put_record(const struct trace_writer* self, uint8_t* rec,
+                 const uint8_t* msg, unsigned long long read_nsecs)
+{
+    assert(self);
+
+    static const size_t hdrlen = offsetof(struct hdr, buf);
+
+    size_t len = 0;
+
+    if (self->timed) {
+        uint64_t tstamp = read_nsecs - self->start_nsecs;
+        memcpy(rec, &tstamp, sizeof(tstamp));
+        len += sizeof(tstamp);
+    }
+
+    size_t msglen = hdrlen + msg[offsetof(struct hdr, len)];
+    memcpy(rec + len, msg, msglen);
+
+    return len + msglen;
+}
+
+void
+trace_append_tx(const struct trace_writer* self, const uint8_t* recs,
+                size_t len)
+{
+    assert(self);
+
+    write_tx(self->fd, recs, len);
+}
+
+int
+trace_read_header(int fd, bool* timed)
+{
+    assert(timed);
+
+    struct trace_header hdr;
+
+    ssize_t res = read(fd, &hdr, sizeof(hdr));
+    if (res < 0) {
+        perror("read");
+        return -1;
+    }
+    if (((size_t)res < sizeof(hdr)) ||
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic))) {
+        fprintf(stderr, "Input is not a trace.\n");
+        return -1;
+    }
+    if (hdr.version != TRACE_VERSION) {
+        fprintf(stderr, "Unsupported trace version %u.\n", hdr.version);
+        return -1;
+    }
+
+    *timed = hdr.flags & TRACE_TIMED;
+
+    return 0;
+}
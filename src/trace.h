@@ -0,0 +1,80 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "data.h"
+
+/* Traces
+ *
+ * A trace starts with a header, followed by the recorded messages in
+ * the format of the input stream. In timed traces, each message is
+ * preceded by the time it arrived, in nanoseconds since the recording
+ * started, as a 64-bit integer in host byte order.
+ */
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+};
+
+/* The trace contains arrival times. */
+#define TRACE_TIMED     (1u << 0)
+
+/* Upper limit for the size of a recorded message */
+#define TRACE_MAX_RECORD_SIZE (sizeof(uint64_t) + sizeof(struct hdr))
+
+/* Records messages from all input threads into a single trace. Each
+ * input transaction appends its messages with a single write, so the
+ * trace only contains messages of committed transactions. */
+struct trace_writer {
+    int fd;
+    bool timed;
+    /* time when the recording started */
+    unsigned long long start_nsecs;
+};
+
+/* Creates the trace file `filename`. With `timed` set, the messages'
+ * arrival times are recorded. Returns 0 on success, or -1 on errors.
+ */
+int
+trace_writer_open(struct trace_writer* self, const char* filename,
+                  bool timed);
+
+/* Writes the message `msg`, which arrived at `read_nsecs`, into `rec`.
+ * The buffer has room for at least TRACE_MAX_RECORD_SIZE bytes.
+ * Returns the size of the record. */
+size_t
+trace_put_record(const struct trace_writer* self, uint8_t* rec,
+                 const uint8_t* msg, unsigned long long read_nsecs);
+
+/* Appends records within the calling transaction. */
+void
+trace_append_tx(const struct trace_writer* self, const uint8_t* recs,
+                size_t len);
+
+/* Reads and validates a trace's header from `fd`. Sets `timed` if the
+ * trace contains arrival times. Returns 0 on success, or -1 on errors.
+ */
+int
+trace_read_header(int fd, bool* timed);
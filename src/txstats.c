@@ -0,0 +1,301 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "txstats.h"
+#include <assert.h>
+#include <picotm/picotm.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "clock.h"
+#include "ptr.h"
+
+/* Upper limit for the number of transaction sites */
+#define MAX_TX_SITES    64
+
+/* A thread's statistics for a single site. Each thread writes its
+ * own counters; readers sum them up concurrently. */
+struct tx_counters {
+    atomic_ulong nattempts;
+    atomic_ulong ncommits;
+    atomic_ulong nfailures;
+    atomic_ulong nerrors[TX_NERROR_CLASSES];
+    atomic_ulong nsecs; /* time from first attempt until commit */
+
+    /* Private to the writer thread */
+    bool active;
+    unsigned long long beg;
+};
+
+struct tx_thread_stats {
+    struct tx_thread_stats* next;
+    struct tx_counters site[MAX_TX_SITES];
+};
+
+/* The registry of sites and threads. Threads' statistics are never
+ * freed, so they remain available after the thread terminated. */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tx_site* g_site[MAX_TX_SITES];
+static unsigned int g_nsites;
+static struct tx_thread_stats* g_threads;
+
+static _Thread_local struct tx_thread_stats* t_stats;
+
+/* The thread's current transaction and its number of attempts. These
+ * don't depend on the statistics, so restarts stay bounded if no
+ * counters are available. Transactions don't nest, so a thread has at
+ * most one current transaction. */
+static _Thread_local const struct tx_site* t_current;
+static _Thread_local unsigned long t_nattempts;
+
+static struct tx_thread_stats*
+get_thread_stats(void)
+{
+    if (t_stats) {
+        return t_stats;
+    }
+
+    struct tx_thread_stats* stats = calloc(1, sizeof(*stats));
+    if (!stats) {
+        return NULL; /* statistics are optional */
+    }
+
+    pthread_mutex_lock(&g_lock);
+    stats->next = g_threads;
+    g_threads = stats;
+    pthread_mutex_unlock(&g_lock);
+
+    t_stats = stats;
+
+    return stats;
+}
+
+static void
+register_site(struct tx_site* site)
+{
+    pthread_mutex_lock(&g_lock);
+
+    if (!atomic_load_explicit(&site->id, memory_order_relaxed) &&
+        (g_nsites < arraylen(g_site))) {
+        g_site[g_nsites++] = site;
+        atomic_store_explicit(&site->id, g_nsites, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* Returns the current thread's counters of the site, or NULL if
+ * statistics are not available. */
+static struct tx_counters*
+get_counters(struct tx_site* site)
+{
+    assert(site);
+
+    unsigned int id = atomic_load_explicit(&site->id, memory_order_acquire);
+    if (!id) {
+        register_site(site);
+        id = atomic_load_explicit(&site->id, memory_order_acquire);
+        if (!id) {
+            return NULL; /* too many sites */
+        }
+    }
+
+    struct tx_thread_stats* stats = get_thread_stats();
+    if (!stats) {
+        return NULL;
+    }
+
+    return stats->site + id - 1;
+}
+
+static void
+inc_counter(atomic_ulong* counter, unsigned long n)
+{
+    /* Only the owner thread writes the counter. */
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter,
+                                               memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+void
+tx_site_attempt(struct tx_site* site)
+{
+    assert(site);
+
+    if (t_current != site) {
+        t_current = site;
+        t_nattempts = 0;
+    }
+    ++t_nattempts;
+
+    struct tx_counters* counters = get_counters(site);
+    if (!counters) {
+        return;
+    }
+
+    inc_counter(&counters->nattempts, 1);
+
+    if (!counters->active) {
+        counters->active = true;
+        counters->beg = monotonic_nsecs();
+    }
+}
+
+unsigned long
+tx_site_restarts(struct tx_site* site)
+{
+    assert(site);
+
+    if (t_current != site) {
+        /* No attempt has been counted; give up. */
+        return ULONG_MAX;
+    }
+
+    return t_nattempts - 1;
+}
+
+static void
+finish(struct tx_site* site, struct tx_counters* counters)
+{
+    if (t_current == site) {
+        t_current = NULL;
+    }
+
+    if (!counters) {
+        return;
+    }
+
+    inc_counter(&counters->nsecs, monotonic_nsecs() - counters->beg);
+    counters->active = false;
+}
+
+void
+tx_site_error(struct tx_site* site)
+{
+    struct tx_counters* counters = get_counters(site);
+    if (!counters) {
+        return;
+    }
+
+    enum tx_error_class error_class;
+
+    switch (picotm_error_status()) {
+        case PICOTM_CONFLICTING:
+            error_class = TX_ERROR_CONFLICT;
+            break;
+        case PICOTM_REVOCABLE:
+            error_class = TX_ERROR_REVOCABLE;
+            break;
+        case PICOTM_ERROR_CODE:
+            error_class = TX_ERROR_CODE;
+            break;
+        case PICOTM_ERRNO:
+        default:
+            error_class = TX_ERROR_ERRNO;
+            break;
+    }
+
+    inc_counter(counters->nerrors + error_class, 1);
+}
+
+void
+tx_site_failure(struct tx_site* site)
+{
+    struct tx_counters* counters = get_counters(site);
+    if (counters) {
+        inc_counter(&counters->nfailures, 1);
+    }
+    finish(site, counters);
+}
+
+void
+tx_site_commit(struct tx_site* site)
+{
+    struct tx_counters* counters = get_counters(site);
+    if (counters) {
+        inc_counter(&counters->ncommits, 1);
+    }
+    finish(site, counters);
+}
+
+static unsigned long
+load_counter(const atomic_ulong* counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void
+print_tx_stats(FILE* stream)
+{
+    assert(stream);
+
+    pthread_mutex_lock(&g_lock);
+
+    fprintf(stream, "Transactions:\n");
+    fprintf(stream, "  %-28s %10s %10s %8s %8s %8s %8s %8s %8s %10s\n",
+            "site", "commits", "restarts", "conflict", "revoc",
+            "code", "errno", "failed", "usecs/tx", "total ms");
+
+    for (unsigned int i = 0; i < g_nsites; ++i) {
+
+        unsigned long nattempts = 0;
+        unsigned long ncommits = 0;
+        unsigned long nfailures = 0;
+        unsigned long nerrors[TX_NERROR_CLASSES] = { 0 };
+        unsigned long nsecs = 0;
+
+        for (const struct tx_thread_stats* stats = g_threads;
+                                           stats;
+                                           stats = stats->next) {
+            const struct tx_counters* counters = stats->site + i;
+
+            nattempts += load_counter(&counters->nattempts);
+            ncommits += load_counter(&counters->ncommits);
+            nfailures += load_counter(&counters->nfailures);
+            for (int j = 0; j < TX_NERROR_CLASSES; ++j) {
+                nerrors[j] += load_counter(counters->nerrors + j);
+            }
+            nsecs += load_counter(&counters->nsecs);
+        }
+
+        /* Each attempt that neither committed nor failed has been
+         * restarted; either by picotm after a conflict, or by the
+         * error recovery. Transactions in progress count as well. */
+        unsigned long nfinished = ncommits + nfailures;
+        unsigned long nrestarts = nattempts > nfinished ? nattempts - nfinished
+                                                        : 0;
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s:%d", g_site[i]->func,
+                 g_site[i]->line);
+
+        fprintf(stream,
+                "  %-28s %10lu %10lu %8lu %8lu %8lu %8lu %8lu %8.2f %10.1f\n",
+                name, ncommits, nrestarts,
+                nerrors[TX_ERROR_CONFLICT], nerrors[TX_ERROR_REVOCABLE],
+                nerrors[TX_ERROR_CODE], nerrors[TX_ERROR_ERRNO], nfailures,
+                nfinished ? (nsecs / 1e3) / nfinished : 0.0,
+                nsecs / 1e6);
+    }
+
+    pthread_mutex_unlock(&g_lock);
+}
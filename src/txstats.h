@@ -0,0 +1,95 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+/* A call site of a transaction. Each transaction block declares a
+ * static site and reports its attempts, errors and commits. The
+ * statistics are kept per thread and summed up on demand.
+ *
+ *  static struct tx_site site = TX_SITE_INITIALIZER;
+ *
+ *  picotm_begin
+ *      tx_site_attempt(&site);
+ *      ...
+ *  picotm_commit
+ *      int res = recover_from_tx_error(&site);
+ *      ...
+ *  picotm_end
+ *
+ *  tx_site_commit(&site);
+ */
+struct tx_site {
+    const char* file;
+    int line;
+    const char* func;
+
+    /* The site's index plus one, or 0 if it hasn't been registered */
+    atomic_uint id;
+};
+
+#define TX_SITE_INITIALIZER         \
+    {                               \
+        .file = __FILE__,           \
+        .line = __LINE__,           \
+        .func = __func__,           \
+        .id = ATOMIC_VAR_INIT(0)    \
+    }
+
+/* Classes of transaction errors */
+enum tx_error_class {
+    TX_ERROR_CONFLICT,
+    TX_ERROR_REVOCABLE,
+    TX_ERROR_CODE,
+    TX_ERROR_ERRNO,
+    TX_NERROR_CLASSES
+};
+
+/* Counts an attempt of the site's transaction. Call at the beginning
+ * of the transaction; the first attempt starts the site's timer. */
+void
+tx_site_attempt(struct tx_site* site);
+
+/* Returns the number of restarts of the site's current transaction
+ * in the calling thread. Restarts are counted even if the site has no
+ * statistics. If no attempt of the site has been counted, the result
+ * is ULONG_MAX, so that the transaction is given up. */
+unsigned long
+tx_site_restarts(struct tx_site* site);
+
+/* Counts an error of the class reported by picotm_error_status(). */
+void
+tx_site_error(struct tx_site* site);
+
+/* Counts a transaction that has been given up after an error. */
+void
+tx_site_failure(struct tx_site* site);
+
+/* Counts a commit of the site's transaction. Call after the
+ * transaction block. */
+void
+tx_site_commit(struct tx_site* site);
+
+/* Prints the statistics of all sites, summed up over all threads. */
+void
+print_tx_stats(FILE* stream);
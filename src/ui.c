@@ -23,6 +23,7 @@
 #include <picotm/picotm.h>
 #include <picotm/picotm-tm-ctypes.h>
 #include <picotm/stdlib.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -51,8 +52,12 @@
 #endif
 
 #include "buf.h"
+#include "hist.h"
+#include "pipeline.h"
+#include "proc.h"
 #include "ptr.h"
 #include "recovery.h"
+#include "txstats.h"
 
 static void
 ncurses_atexit(void)
@@ -60,66 +65,111 @@ ncurses_atexit(void)
     endwin();
 }
 
-static unsigned int
-field_sum_tx(const uint8_t* field)
-{
-    unsigned int sum = 0;
-
-    privatize_tx(field, 256, PICOTM_TM_PRIVATIZE_LOAD);
+/* Set by <ctrl-c> to leave the UI */
+static volatile sig_atomic_t g_quit;
 
-    const uint8_t* beg = field;
-    const uint8_t* end = field + 256;
+static void
+sigint_handler(int signum)
+{
+    g_quit = 1;
+}
 
-    for (const uint8_t* pos = beg; pos < end; ++pos) {
-        sum += *pos;
+/* Interrupted system calls are not restarted, so a pending sleep()
+ * returns as soon as <ctrl-c> has been pressed. */
+static int
+install_sigint_handler(void)
+{
+    struct sigaction act = {
+        .sa_handler = sigint_handler
+    };
+    sigemptyset(&act.sa_mask);
+
+    int res = sigaction(SIGINT, &act, NULL);
+    if (res < 0) {
+        perror("sigaction");
+        return -1;
     }
-
-    return sum;
+    return 0;
 }
 
-static int
+static void
 fill_out_buffer(char* out, size_t outlen, struct data_buf* buf)
 {
-    const uint8_t (*field)[256] = buf->field;
-
     const size_t nsteps = arraylen(buf->field) / outlen;
 
-    char* out_beg = out;
-    char* out_end = out + outlen;
+    /* The range sums come from a snapshot of the buffer's index, so
+     * refreshing neither scans the fields nor runs a transaction that
+     * could conflict with the processing threads. All characters are
+     * computed from the same snapshot. */
+
+    struct data_buf_snapshot snap;
+    data_buf_snapshot(buf, &snap);
 
-    for (char* out_pos = out_beg; out_pos < out_end; ++out_pos) {
+    for (size_t i = 0; i < outlen; ++i) {
 
         static const char character[16] = {
             '0', '1', '2', '3', '4', '5', '6', '7',
             '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
         };
 
-        picotm_begin
+        unsigned long sum = data_buf_snapshot_range_sum(&snap, i * nsteps,
+                                                        (i + 1) * nsteps);
 
-            unsigned int sum = 0;
+        out[i] = character[sum / (nsteps * (256 * arraylen(character)))];
+    }
+}
 
-            for (size_t i = 0; i < nsteps; ++i, ++field) {
-                sum += field_sum_tx(*field);
-            }
+static double
+entries_per_commit(const struct proc_stats* stats)
+{
+    unsigned long ncommits = atomic_load_explicit(&stats->ncommits,
+                                                  memory_order_relaxed);
+    unsigned long nentries = atomic_load_explicit(&stats->nentries,
+                                                  memory_order_relaxed);
+    if (!ncommits) {
+        return 0;
+    }
+    return (double)nentries / (double)ncommits;
+}
 
-            size_t i = sum / (nsteps * (256 * arraylen(character)));
+/* Screen rows of the latency panel */
+static const int LATENCY_PANEL_ROWS = 2 + NLATENCIES;
 
-            store_char_tx(out_pos, character[i]);
-        picotm_commit
-            int res = recover_from_tx_error(__FILE__, __LINE__);
-            if (res < 0) {
-                return -1;
-            }
-            picotm_restart();
-        picotm_end
-    }
+static void
+print_latency_panel(int row, const struct proc_stats* stats, size_t nstats,
+                    struct hist* hist)
+{
+    mvprintw(row, 2, "%-16s %10s %10s %10s %10s",
+             "Latency (usecs)", "p50", "p99", "p99.9", "max");
 
-    return 0;
+    for (int i = 0; i < NLATENCIES; ++i) {
+
+        hist_init(hist);
+        proc_stats_merge_latency(stats, nstats, i, hist);
+
+        mvprintw(row + 1 + i, 4, "%-14s %10.1f %10.1f %10.1f %10.1f",
+                 proc_latency_name(i),
+                 hist_percentile(hist, 50) / 1e3,
+                 hist_percentile(hist, 99) / 1e3,
+                 hist_percentile(hist, 99.9) / 1e3,
+                 hist_max(hist) / 1e3);
+    }
 }
 
 void
-ui_main(struct data_buf* buf, size_t nbufs)
+ui_main(const struct pipeline* pipe, const struct proc_stats* stats)
 {
+    int res = install_sigint_handler();
+    if (res < 0) {
+        return;
+    }
+
+    struct hist* hist = malloc(sizeof(*hist));
+    if (!hist) {
+        perror("malloc");
+        return;
+    }
+
     /* Init ncurses
      */
 
@@ -130,23 +180,41 @@ ui_main(struct data_buf* buf, size_t nbufs)
 
     nodelay(w, true);
 
+    /* Display only the buffers that fit onto the screen. Each buffer
+     * takes 4 rows below the 10-row header. The latency panel follows
+     * the buffers. */
+
+    size_t nbufs = 1;
+    if (LINES > 10 + 4 + LATENCY_PANEL_ROWS) {
+        nbufs = (LINES - 10 - LATENCY_PANEL_ROWS) / 4;
+    }
+    if (nbufs > pipe->nbufs) {
+        nbufs = pipe->nbufs;
+    }
+
     /* Setup fields for buffer output.
      */
 
     FIELD** field;
 
+    static struct tx_site site = TX_SITE_INITIALIZER;
+
     picotm_begin
+        tx_site_attempt(&site);
+
         size_t tx_nbufs = load_size_t_tx(&nbufs);
         FIELD** tx_field = malloc_tx((1 + tx_nbufs) * sizeof(*tx_field));
         store_ptr_tx(&field, tx_field);
     picotm_commit
-        int res = recover_from_tx_error(__FILE__, __LINE__);
+        int res = recover_from_tx_error(&site);
         if (res < 0) {
-            return;
+            goto out;
         }
         picotm_restart();
     picotm_end
 
+    tx_site_commit(&site);
+
     for (size_t i = 0; i < nbufs; ++i) {
         field[i] = new_field(1, 64, 12 + 4 * i, 8, 0, 0);
         set_field_back(field[i], A_UNDERLINE);
@@ -158,7 +226,8 @@ ui_main(struct data_buf* buf, size_t nbufs)
     post_form(form);
 
     for (size_t i = 0; i < nbufs; ++i) {
-        mvprintw(10 + 4 * i, 2, "Buffer %zu", i + 1);
+        mvprintw(10 + 4 * i, 2, "Buffer %zu (thread %zu)", i + 1,
+                 pipeline_proc_of_buf(pipe, i) + 1);
     }
 
     /* Display some text and the periodically refresh the output
@@ -171,10 +240,10 @@ ui_main(struct data_buf* buf, size_t nbufs)
                    "buffers. You should see the buffers slowly filling up.\n"
                    "Press <ctrl-c> to exit");
 
-    while (true) {
+    while (!g_quit) {
 
-        struct data_buf* buf_beg = buf;
-        struct data_buf* buf_end = buf + nbufs;
+        struct data_buf* buf_beg = pipe->buf;
+        struct data_buf* buf_end = pipe->buf + nbufs;
 
         for (struct data_buf* buf = buf_beg; buf < buf_end; ++buf) {
 
@@ -185,12 +254,17 @@ ui_main(struct data_buf* buf, size_t nbufs)
             static_assert(!(arraylen(buf->field) % arraylen(out)),
                           "field length is not a multiple of output length");
 
-            int res = fill_out_buffer(out, arraylen(out), buf);
-            if (res < 0) {
-                return;
-            }
+            fill_out_buffer(out, arraylen(out), buf);
 
             mvprintw(12 + 4 * (buf -  buf_beg), 8, "%.*s", arraylen(out), out);
+            const struct proc_stats* st =
+                stats + pipeline_proc_of_buf(pipe, buf - buf_beg);
+            mvprintw(13 + 4 * (buf -  buf_beg), 8,
+                     "%.2f messages/commit, %lu stolen",
+                     entries_per_commit(st),
+                     atomic_load_explicit(&st->nstolen, memory_order_relaxed));
+
+            print_latency_panel(11 + 4 * nbufs, stats, pipe->nprocs, hist);
 
             refresh();
 
@@ -199,6 +273,15 @@ ui_main(struct data_buf* buf, size_t nbufs)
              * simply sleep for a second.
              */
             sleep(1);
+
+            if (g_quit) {
+                break;
+            }
         }
     }
+
+out:
+    /* Leave curses mode, so the caller can print to the terminal. */
+    endwin();
+    free(hist);
 }
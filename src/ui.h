@@ -20,9 +20,11 @@
 
 #pragma once
 
-#include <stddef.h>
-
-struct data_buf;
+struct pipeline;
+struct proc_stats;
 
+/* Displays the pipeline's buffers and the statistics of its processing
+ * threads until the user presses <ctrl-c>. The array `stats` contains
+ * one element per processing thread. */
 void
-ui_main(struct data_buf* buf, size_t nbufs);
+ui_main(const struct pipeline* pipe, const struct proc_stats* stats);
@@ -0,0 +1,171 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "wakeup.h"
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "clock.h"
+
+void
+wakeup_init(struct wakeup* self)
+{
+    assert(self);
+
+    atomic_init(&self->seq, 0);
+    atomic_init(&self->nwaiters, 0);
+}
+
+static long
+futex(atomic_uint* uaddr, int op, unsigned int val,
+      const struct timespec* timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+void
+wakeup_signal(struct wakeup* self)
+{
+    assert(self);
+
+    /* The sequence number has to be advanced before the number of
+     * waiters is read. A waiter increments the number of waiters
+     * before it compares the sequence number in the kernel. Either
+     * the waiter sees the new sequence number, or we see the waiter.
+     */
+    atomic_fetch_add_explicit(&self->seq, 1, memory_order_seq_cst);
+
+    if (!atomic_load_explicit(&self->nwaiters, memory_order_seq_cst)) {
+        return;
+    }
+
+    long res = futex(&self->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+    if (res < 0) {
+        perror("futex");
+        abort();
+    }
+}
+
+unsigned int
+wakeup_seq(struct wakeup* self)
+{
+    assert(self);
+
+    return atomic_load_explicit(&self->seq, memory_order_seq_cst);
+}
+
+static void
+cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+/* Busy-polls the sequence number for up to `nsecs` nanoseconds.
+ * Returns true if the sequence number changed. */
+static bool
+spin_on_seq(struct wakeup* self, unsigned int seq, unsigned long nsecs)
+{
+    unsigned long long deadline = 0;
+
+    for (unsigned long i = 0;; ++i) {
+        if (atomic_load_explicit(&self->seq,
+                                 memory_order_acquire) != seq) {
+            return true;
+        }
+        /* Reading the clock costs more than polling, so we only do
+         * it once in a while. */
+        if (!(i % 64)) {
+            unsigned long long now = monotonic_nsecs();
+            if (!deadline) {
+                deadline = now + nsecs;
+            } else if (now >= deadline) {
+                return false;
+            }
+        }
+        cpu_relax();
+    }
+}
+
+static void
+park_on_seq(struct wakeup* self, unsigned int seq, unsigned long nsecs)
+{
+    const struct timespec timeout = {
+        .tv_sec = nsecs / 1000000000,
+        .tv_nsec = nsecs % 1000000000
+    };
+
+    atomic_fetch_add_explicit(&self->nwaiters, 1, memory_order_seq_cst);
+
+    while (atomic_load_explicit(&self->seq,
+                                memory_order_seq_cst) == seq) {
+        long res = futex(&self->seq, FUTEX_WAIT_PRIVATE, seq,
+                         nsecs ? &timeout : NULL);
+        if (res < 0) {
+            if (errno == ETIMEDOUT) {
+                break;
+            } else if ((errno != EAGAIN) && (errno != EINTR)) {
+                perror("futex");
+                abort();
+            }
+        }
+    }
+
+    atomic_fetch_sub_explicit(&self->nwaiters, 1, memory_order_relaxed);
+}
+
+void
+wakeup_wait(struct wakeup* self, unsigned int seq,
+            const struct wait_config* config)
+{
+    assert(self);
+    assert(config);
+
+    switch (config->strategy) {
+        case WAIT_PARK:
+            park_on_seq(self, seq, config->timeout_nsecs);
+            break;
+        case WAIT_SPIN:
+            if (!spin_on_seq(self, seq, config->spin_nsecs)) {
+                park_on_seq(self, seq, config->timeout_nsecs);
+            }
+            break;
+        case WAIT_POLL:
+            if (config->timeout_nsecs) {
+                spin_on_seq(self, seq, config->timeout_nsecs);
+                break;
+            }
+            while (atomic_load_explicit(&self->seq,
+                                        memory_order_acquire) == seq) {
+                cpu_relax();
+            }
+            break;
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+
+/* A wakeup is an event counter for waking up sleeping threads.
+ * Waiters read the sequence number, check their wakeup condition and
+ * wait for the sequence number to change. Signalling is cheap if no
+ * thread is waiting. The sequence number is a futex.
+ */
+struct wakeup {
+    alignas(64) atomic_uint seq;
+    atomic_uint nwaiters;
+};
+
+void
+wakeup_init(struct wakeup* self);
+
+/* Advances the sequence number and wakes up all waiting threads. */
+void
+wakeup_signal(struct wakeup* self);
+
+/* Returns the current sequence number. Waiters read the sequence
+ * number *before* they check their wakeup condition. */
+unsigned int
+wakeup_seq(struct wakeup* self);
+
+enum wait_strategy {
+    /* Sleep immediately. */
+    WAIT_PARK,
+    /* Busy-poll for a limited time, then sleep. */
+    WAIT_SPIN,
+    /* Busy-poll without ever sleeping. Occupies a CPU core. */
+    WAIT_POLL
+};
+
+struct wait_config {
+    enum wait_strategy strategy;
+    unsigned long spin_nsecs; /* busy-poll budget for WAIT_SPIN */
+    unsigned long timeout_nsecs; /* maximum wait time, or 0 for none */
+};
+
+/* Waits until the sequence number differs from `seq`. Returns
+ * immediately if that already happened. If the configuration contains
+ * a timeout, the function also returns after that time.
+ */
+void
+wakeup_wait(struct wakeup* self, unsigned int seq,
+            const struct wait_config* config);
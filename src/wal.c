@@ -0,0 +1,876 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "wal.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <picotm/picotm-tm.h>
+#include <picotm/unistd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "buf.h"
+#include "clock.h"
+#include "ptr.h"
+
+static const char CHECKPOINT_MAGIC[8] = "PTMDCKP";
+
+/* Incremented whenever the layout of the checkpoint or the log
+ * changes */
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t row_size;
+    uint64_t nbufs;
+    /* the first log segment to replay */
+    uint64_t segment;
+};
+
+/*
+ * Records
+ */
+
+/* Records are packed back to back, so a record's header is usually
+ * unaligned within the log. Headers are built and parsed on the stack
+ * and copied from and to the log with memcpy(). */
+
+static uint32_t
+fnv1a(uint32_t hash, const uint8_t* beg, const uint8_t* end)
+{
+    for (; beg < end; ++beg) {
+        hash = (hash ^ *beg) * 16777619u;
+    }
+    return hash;
+}
+
+/* FNV-1a over the record's fields and data */
+static uint32_t
+record_checksum(const struct wal_record* hdr, const uint8_t* data)
+{
+    uint32_t hash = fnv1a(2166136261u, (const uint8_t*)&hdr->buf,
+                          (const uint8_t*)(hdr + 1));
+    return fnv1a(hash, data, data + hdr->len);
+}
+
+size_t
+wal_put_record_tx(struct wal* self, uint8_t* rec, const struct data_buf* buf,
+                  size_t row, const uint8_t* data, size_t len)
+{
+    assert(self);
+    assert(buf >= self->buf);
+    assert(buf < self->buf + self->nbufs);
+    assert(row < arraylen(buf->field));
+    assert(len < 256);
+
+    privatize_tx(data, len, PICOTM_TM_PRIVATIZE_LOAD);
+
+    struct wal_record hdr = {
+        .buf = buf - self->buf,
+        .row = row,
+        .len = len
+    };
+    hdr.checksum = record_checksum(&hdr, data);
+
+    memcpy(rec, &hdr, sizeof(hdr));
+    memcpy(rec + sizeof(hdr), data, len);
+
+    return sizeof(hdr) + len;
+}
+
+static void
+apply_record(struct wal* self, const struct wal_record* hdr,
+             const uint8_t* data)
+{
+    uint8_t* field = self->buf[hdr->buf].field[hdr->row];
+
+    memcpy(field, data, hdr->len);
+    memset(field + hdr->len, 0, 256 - hdr->len);
+}
+
+/*
+ * Files
+ */
+
+static int
+make_path(char* path, const char* dirname, const char* name)
+{
+    int res = snprintf(path, PATH_MAX, "%s/%s", dirname, name);
+    if (res >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        perror("snprintf");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+make_segment_path(char* path, const char* dirname, unsigned long segment)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "log.%lu", segment);
+
+    return make_path(path, dirname, name);
+}
+
+static int
+sync_dir(const char* dirname)
+{
+    int fd = open(dirname, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    int res = fsync(fd);
+    if (res < 0) {
+        perror("fsync");
+        goto err_fsync;
+    }
+    close(fd);
+
+    return 0;
+
+err_fsync:
+    close(fd);
+    return -1;
+}
+
+/* Creates an empty log segment and returns its file descriptor, or -1
+ * on errors. */
+static int
+create_segment(struct wal* self, unsigned long segment)
+{
+    char path[PATH_MAX];
+    int res = make_segment_path(path, self->config.dirname, segment);
+    if (res < 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+
+    res = sync_dir(self->config.dirname);
+    if (res < 0) {
+        goto err_sync_dir;
+    }
+
+    return fd;
+
+err_sync_dir:
+    close(fd);
+    return -1;
+}
+
+static void
+remove_segment(struct wal* self, unsigned long segment)
+{
+    char path[PATH_MAX];
+    int res = make_segment_path(path, self->config.dirname, segment);
+    if (res < 0) {
+        return;
+    }
+    res = unlink(path);
+    if (res < 0 && errno != ENOENT) {
+        perror("unlink");
+    }
+}
+
+/*
+ * Checkpoints
+ */
+
+/* Opens the checkpoint and checks its header. Returns the file in
+ * `file` and the first log segment to replay in `segment`. Without
+ * checkpoint, `file` is NULL and replay starts with the first
+ * segment. */
+static int
+open_checkpoint(struct wal* self, FILE** file, unsigned long* segment)
+{
+    char path[PATH_MAX];
+    int res = make_path(path, self->config.dirname, "checkpoint");
+    if (res < 0) {
+        return -1;
+    }
+
+    *file = fopen(path, "r");
+    if (!*file) {
+        if (errno == ENOENT) {
+            *segment = 0;
+            return 0;
+        }
+        perror("fopen");
+        return -1;
+    }
+
+    struct checkpoint_header hdr;
+    size_t n = fread(&hdr, sizeof(hdr), 1, *file);
+    if (n < 1) {
+        fprintf(stderr, "%s: truncated checkpoint\n", path);
+        goto err;
+    }
+    if (memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic)) ||
+        (hdr.version != CHECKPOINT_VERSION) || (hdr.row_size != 256)) {
+        fprintf(stderr, "%s: unsupported checkpoint\n", path);
+        goto err;
+    }
+    if (hdr.nbufs != self->nbufs) {
+        fprintf(stderr, "%s: checkpoint holds %llu buffers\n", path,
+                (unsigned long long)hdr.nbufs);
+        goto err;
+    }
+
+    /* The rows are read later, by their buffers' processing
+     * threads. */
+    struct stat st;
+    res = fstat(fileno(*file), &st);
+    if (res < 0) {
+        perror("fstat");
+        goto err;
+    }
+    if ((unsigned long long)st.st_size !=
+        sizeof(hdr) + self->nbufs * sizeof(self->buf->field)) {
+        fprintf(stderr, "%s: truncated checkpoint\n", path);
+        goto err;
+    }
+
+    *segment = hdr.segment;
+
+    return 0;
+
+err:
+    fclose(*file);
+    return -1;
+}
+
+/* Loads the rows of buffer `i` from the checkpoint. */
+static int
+load_checkpoint_buf(struct wal* self, FILE* file, size_t i)
+{
+    long off = sizeof(struct checkpoint_header) +
+               i * sizeof(self->buf[i].field);
+
+    int res = fseek(file, off, SEEK_SET);
+    if (res < 0) {
+        perror("fseek");
+        return -1;
+    }
+    size_t n = fread(self->buf[i].field, sizeof(self->buf[i].field), 1,
+                     file);
+    if (n < 1) {
+        fprintf(stderr, "%s/checkpoint: truncated checkpoint\n",
+                self->config.dirname);
+        return -1;
+    }
+    return 0;
+}
+
+/* Writes the buffers' rows to a new checkpoint that starts replay at
+ * `segment`. Rows are copied from consistent snapshots, so the
+ * processing threads keep running. Each row holds at least the data of
+ * all transactions that ended before the row was copied. */
+static int
+write_checkpoint(struct wal* self, unsigned long segment)
+{
+    char tmp_path[PATH_MAX];
+    int res = make_path(tmp_path, self->config.dirname, "checkpoint.tmp");
+    if (res < 0) {
+        return -1;
+    }
+
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        perror("fopen");
+        return -1;
+    }
+
+    struct checkpoint_header hdr = {
+        .version = CHECKPOINT_VERSION,
+        .row_size = 256,
+        .nbufs = self->nbufs,
+        .segment = segment
+    };
+    memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic));
+
+    size_t n = fwrite(&hdr, sizeof(hdr), 1, file);
+    if (n < 1) {
+        perror("fwrite");
+        goto err;
+    }
+
+    for (size_t i = 0; i < self->nbufs; ++i) {
+        for (size_t row = 0; row < 256; ++row) {
+            uint8_t row_buf[256];
+            data_buf_snapshot_row(self->buf + i, row, row_buf);
+
+            n = fwrite(row_buf, sizeof(row_buf), 1, file);
+            if (n < 1) {
+                perror("fwrite");
+                goto err;
+            }
+        }
+    }
+
+    res = fflush(file);
+    if (res) {
+        perror("fflush");
+        goto err;
+    }
+    res = fsync(fileno(file));
+    if (res < 0) {
+        perror("fsync");
+        goto err;
+    }
+    fclose(file);
+
+    char path[PATH_MAX];
+    res = make_path(path, self->config.dirname, "checkpoint");
+    if (res < 0) {
+        return -1;
+    }
+    res = rename(tmp_path, path);
+    if (res < 0) {
+        perror("rename");
+        return -1;
+    }
+
+    return sync_dir(self->config.dirname);
+
+err:
+    fclose(file);
+    return -1;
+}
+
+/*
+ * Recovery
+ */
+
+/* Checks the records of a log segment. Sets `found` if the segment
+ * exists. The check stops at the first incomplete or damaged record,
+ * which is where the log ended when the previous run stopped; the
+ * segment is cut off there and `torn` is set. */
+static int
+check_segment(struct wal* self, unsigned long segment, bool* found,
+              bool* torn)
+{
+    char path[PATH_MAX];
+    int res = make_segment_path(path, self->config.dirname, segment);
+    if (res < 0) {
+        return -1;
+    }
+
+    *found = false;
+    *torn = false;
+
+    FILE* file = fopen(path, "r+");
+    if (!file) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror("fopen");
+        return -1;
+    }
+    *found = true;
+
+    struct wal_record hdr;
+    uint8_t data[UINT8_MAX];
+
+    long end = 0;
+
+    while (1) {
+        size_t n = fread(&hdr, sizeof(hdr), 1, file);
+        if (n < 1) {
+            *torn = !feof(file) || (ftell(file) != end);
+            break;
+        }
+        n = fread(data, 1, hdr.len, file);
+        if ((n < hdr.len) ||
+            (hdr.checksum != record_checksum(&hdr, data)) ||
+            (hdr.buf >= self->nbufs)) {
+            *torn = true;
+            break;
+        }
+        end = ftell(file);
+    }
+
+    if (*torn) {
+        fprintf(stderr, "%s: log ends at offset %ld\n", path, end);
+        res = ftruncate(fileno(file), end);
+        if (res < 0) {
+            perror("ftruncate");
+            goto err;
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+
+err:
+    fclose(file);
+    return -1;
+}
+
+/* Applies the records of a checked log segment to the buffers `beg`,
+ * `beg + step`, and so on. */
+static int
+replay_segment(struct wal* self, unsigned long segment, size_t beg,
+               size_t step)
+{
+    char path[PATH_MAX];
+    int res = make_segment_path(path, self->config.dirname, segment);
+    if (res < 0) {
+        return -1;
+    }
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror("fopen");
+        return -1;
+    }
+
+    struct wal_record hdr;
+    uint8_t data[UINT8_MAX];
+
+    while (fread(&hdr, sizeof(hdr), 1, file) == 1) {
+        size_t n = fread(data, 1, hdr.len, file);
+        if (n < hdr.len) {
+            break;
+        }
+        if ((hdr.buf >= beg) && !((hdr.buf - beg) % step)) {
+            apply_record(self, &hdr, data);
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/* Checks the log and returns the range of segments to replay. All
+ * checked segments remain in place until the new checkpoint has been
+ * written. */
+static int
+recover(struct wal* self, unsigned long* first, unsigned long* next)
+{
+    FILE* checkpoint;
+    int res = open_checkpoint(self, &checkpoint, first);
+    if (res < 0) {
+        return -1;
+    }
+    if (checkpoint) {
+        fclose(checkpoint);
+    }
+
+    unsigned long segment = *first;
+
+    while (1) {
+        bool found, torn;
+        res = check_segment(self, segment, &found, &torn);
+        if (res < 0) {
+            return -1;
+        }
+        if (!found) {
+            break;
+        }
+        ++segment;
+        if (torn) {
+            break;
+        }
+    }
+
+    *next = segment;
+
+    /* Later segments have been written after a torn record. They
+     * cannot be replayed and would be mistaken for the new segments'
+     * successors, so remove them. */
+    for (;; ++segment) {
+        char path[PATH_MAX];
+        res = make_segment_path(path, self->config.dirname, segment);
+        if (res < 0) {
+            return -1;
+        }
+        res = unlink(path);
+        if (res < 0) {
+            if (errno == ENOENT) {
+                break;
+            }
+            perror("unlink");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int
+wal_replay(struct wal* self, size_t beg, size_t step)
+{
+    assert(self);
+    assert(step);
+
+    FILE* checkpoint;
+    unsigned long first;
+    int res = open_checkpoint(self, &checkpoint, &first);
+    if (res < 0) {
+        return -1;
+    }
+
+    if (checkpoint) {
+        for (size_t i = beg; i < self->nbufs; i += step) {
+            res = load_checkpoint_buf(self, checkpoint, i);
+            if (res < 0) {
+                goto err;
+            }
+        }
+        fclose(checkpoint);
+    }
+
+    for (unsigned long segment = self->first_segment;
+         segment < self->segment; ++segment) {
+        res = replay_segment(self, segment, beg, step);
+        if (res < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+
+err:
+    fclose(checkpoint);
+    return -1;
+}
+
+/*
+ * Group commit
+ */
+
+int
+wal_sync(struct wal* self)
+{
+    assert(self);
+
+    int err = 0;
+
+    pthread_mutex_lock(&self->sync_lock);
+
+    /* All counted records have been appended to the log. */
+    unsigned long ncommitted = atomic_load_explicit(&self->ncommitted,
+                                                    memory_order_acquire);
+    if (ncommitted != atomic_load_explicit(&self->nsynced,
+                                           memory_order_relaxed)) {
+        int res = fdatasync(atomic_load(&self->fd));
+        if (res < 0) {
+            perror("fdatasync");
+            err = -1;
+        } else {
+            atomic_store_explicit(&self->nsynced, ncommitted,
+                                  memory_order_relaxed);
+        }
+    }
+
+    pthread_mutex_unlock(&self->sync_lock);
+
+    /* Wake up the committers of the synced records. After a failed
+     * sync, the kernel might have dropped the records' pages, so all
+     * waiting and later committers fail. */
+    pthread_mutex_lock(&self->lock);
+    if (err) {
+        self->failed = true;
+    }
+    pthread_cond_broadcast(&self->synced);
+    pthread_mutex_unlock(&self->lock);
+
+    return err;
+}
+
+/* Starts a new segment and writes a checkpoint that replaces the old
+ * one. The caller holds `sync_lock`. */
+static int
+checkpoint(struct wal* self)
+{
+    int fd = create_segment(self, self->segment + 1);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Transactions that loaded the old descriptor have begun writing
+     * to their buffer before, so the checkpoint's snapshots wait for
+     * them. See wal_append_tx(). */
+    int old_fd = atomic_exchange(&self->fd, fd);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    ++self->segment;
+
+    int res = write_checkpoint(self, self->segment);
+
+    /* All records in the old segment are part of the snapshots now.
+     * Sync them anyway, in case the new checkpoint didn't make it. */
+    int sync_res = fdatasync(old_fd);
+    if (sync_res < 0) {
+        perror("fdatasync");
+    }
+    close(old_fd);
+
+    if (res < 0) {
+        return -1;
+    }
+
+    for (; self->first_segment < self->segment; ++self->first_segment) {
+        remove_segment(self, self->first_segment);
+    }
+
+    return 0;
+}
+
+/* Returns true if the current group should be synced now. The caller
+ * holds `lock`. */
+static bool
+is_group_complete(struct wal* self)
+{
+    unsigned long npending =
+        atomic_load(&self->ncommitted) - atomic_load(&self->nsynced);
+
+    /* Once all processing threads wait for the sync, no further
+     * records can join the group. */
+    return (npending >= self->config.sync_bytes) ||
+           (npending && (self->nwaiting >= self->config.nwriters));
+}
+
+static void
+flusher_main(struct wal* self)
+{
+    const unsigned long long checkpoint_nsecs =
+        self->config.checkpoint_secs * 1000000000ull;
+
+    while (1) {
+
+        unsigned long long deadline = monotonic_nsecs() +
+                                      self->config.sync_nsecs;
+        struct timespec ts = {
+            .tv_sec = deadline / 1000000000,
+            .tv_nsec = deadline % 1000000000
+        };
+
+        pthread_mutex_lock(&self->lock);
+
+        /* Wait until the interval elapsed or the group is complete. */
+        while (!self->stopping && !is_group_complete(self)) {
+            int res = pthread_cond_timedwait(&self->cond, &self->lock, &ts);
+            if (res == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        bool stopping = self->stopping;
+
+        pthread_mutex_unlock(&self->lock);
+
+        if (stopping) {
+            break;
+        }
+
+        /* Errors have been reported to the committers. */
+        wal_sync(self);
+
+        if (monotonic_nsecs() - self->checkpoint_nsecs < checkpoint_nsecs) {
+            continue;
+        }
+
+        pthread_mutex_lock(&self->sync_lock);
+        checkpoint(self);
+        pthread_mutex_unlock(&self->sync_lock);
+
+        self->checkpoint_nsecs = monotonic_nsecs();
+    }
+}
+
+static void*
+flusher_main_cb(void* arg)
+{
+    flusher_main(arg);
+    return NULL;
+}
+
+int
+wal_open(struct wal* self, const struct wal_config* config,
+         struct data_buf* buf, size_t nbufs)
+{
+    assert(self);
+    assert(config);
+    assert(config->nwriters);
+    assert(buf);
+
+    self->config = *config;
+    self->buf = buf;
+    self->nbufs = nbufs;
+
+    int res = mkdir(config->dirname, 0755);
+    if (res < 0 && errno != EEXIST) {
+        perror("mkdir");
+        return -1;
+    }
+
+    unsigned long first, next;
+    res = recover(self, &first, &next);
+    if (res < 0) {
+        return -1;
+    }
+
+    self->first_segment = first;
+    self->segment = next;
+    atomic_init(&self->fd, -1);
+    atomic_init(&self->ncommitted, 0);
+    atomic_init(&self->nsynced, 0);
+    self->nwaiting = 0;
+    self->stopping = false;
+    self->failed = false;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_cond_init(&self->synced, NULL);
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_mutex_init(&self->sync_lock, NULL);
+
+    return 0;
+}
+
+int
+wal_start(struct wal* self)
+{
+    assert(self);
+
+    /* Start with a fresh segment and a checkpoint of the restored
+     * buffers; then the replayed segments are no longer needed. */
+
+    int fd = create_segment(self, self->segment);
+    if (fd < 0) {
+        return -1;
+    }
+    int res = write_checkpoint(self, self->segment);
+    if (res < 0) {
+        goto err_write_checkpoint;
+    }
+    for (; self->first_segment < self->segment; ++self->first_segment) {
+        remove_segment(self, self->first_segment);
+    }
+
+    atomic_store(&self->fd, fd);
+    self->checkpoint_nsecs = monotonic_nsecs();
+
+    int err = pthread_create(&self->flusher, NULL, flusher_main_cb, self);
+    if (err) {
+        errno = err;
+        perror("pthread_create");
+        return -1;
+    }
+    return 0;
+
+err_write_checkpoint:
+    close(fd);
+    return -1;
+}
+
+int
+wal_close(struct wal* self)
+{
+    assert(self);
+
+    pthread_mutex_lock(&self->lock);
+    self->stopping = true;
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+
+    int err = pthread_join(self->flusher, NULL);
+    if (err) {
+        errno = err;
+        perror("pthread_join");
+        return -1;
+    }
+
+    /* Records of the last group have no waiting committer, if the
+     * processing threads stopped on errors. */
+    int res = wal_sync(self);
+
+    close(atomic_load(&self->fd));
+
+    pthread_mutex_destroy(&self->sync_lock);
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->synced);
+    pthread_cond_destroy(&self->cond);
+
+    return res;
+}
+
+void
+wal_append_tx(struct wal* self, const uint8_t* recs, size_t len)
+{
+    assert(self);
+
+    /* Pairs with the fence in checkpoint(). The caller's buffer shows
+     * this writer before we load the descriptor, so a checkpoint that
+     * replaced the descriptor waits for the transaction. */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    write_tx(atomic_load_explicit(&self->fd, memory_order_relaxed),
+             recs, len);
+}
+
+int
+wal_commit(struct wal* self, size_t len)
+{
+    assert(self);
+
+    unsigned long end =
+        atomic_fetch_add_explicit(&self->ncommitted, len,
+                                  memory_order_release) + len;
+
+    pthread_mutex_lock(&self->lock);
+
+    ++self->nwaiting;
+
+    if (is_group_complete(self)) {
+        pthread_cond_signal(&self->cond);
+    }
+
+    while (!self->failed && (atomic_load(&self->nsynced) < end)) {
+        pthread_cond_wait(&self->synced, &self->lock);
+    }
+
+    --self->nwaiting;
+
+    int res = self->failed ? -1 : 0;
+
+    pthread_mutex_unlock(&self->lock);
+
+    return res;
+}
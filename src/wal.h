@@ -0,0 +1,156 @@
+/*
+ * picotm-demo - A demo application for picotm
+ * Copyright (c) 2017-2018  Thomas Zimmermann <contact@tzimmermann.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct data_buf;
+
+/* A log record; followed by `len` bytes of row data. The checksum
+ * covers the remaining fields and the data. */
+struct wal_record {
+    uint32_t checksum;
+    uint16_t buf;
+    uint8_t row;
+    uint8_t len;
+};
+
+/* Upper limit for the size of a record */
+#define WAL_MAX_RECORD_SIZE (sizeof(struct wal_record) + 255)
+
+struct wal_config {
+    /* directory for the log and the checkpoint */
+    const char* dirname;
+    /* fsync the log at least every `sync_nsecs` nanoseconds, ... */
+    unsigned long long sync_nsecs;
+    /* ... or once `sync_bytes` bytes are pending */
+    size_t sync_bytes;
+    /* write a checkpoint every `checkpoint_secs` seconds */
+    unsigned long checkpoint_secs;
+    /* number of processing threads that commit to the log */
+    size_t nwriters;
+};
+
+/* The write-ahead log of the buffers
+ *
+ * Processing transactions append a record for each applied message to
+ * the current log segment. The records become part of the file when
+ * the transaction commits. A flusher thread syncs the log for all
+ * processing threads at once, either after a time interval, after
+ * enough records are pending, or when all processing threads wait for
+ * the sync. Committers wait until their records have been synced.
+ *
+ * Periodically, the flusher starts a new segment and writes all
+ * buffers to a checkpoint. The checkpoint replaces the old segments,
+ * which are then removed.
+ */
+struct wal {
+    struct wal_config config;
+
+    struct data_buf* buf;
+    size_t nbufs;
+
+    /* Segments before `first_segment` have been removed. The current
+     * segment is `segment`. */
+    unsigned long first_segment;
+    unsigned long segment;
+    atomic_int fd;
+
+    /* bytes of committed and of synced records */
+    atomic_ulong ncommitted;
+    atomic_ulong nsynced;
+
+    /* The flusher waits on `cond` for pending records; committers
+     * wait on `synced` for the flusher. Both are protected by `lock`,
+     * as are the fields below. `sync_lock` serializes syncs and
+     * checkpoints. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t synced;
+    pthread_mutex_t sync_lock;
+
+    /* number of committers that wait for the sync */
+    size_t nwaiting;
+    /* set by wal_close() to stop the flusher */
+    bool stopping;
+    /* set once a sync failed */
+    bool failed;
+
+    unsigned long long checkpoint_nsecs;
+
+    pthread_t flusher;
+};
+
+/* Opens the checkpoint and log in the configured directory. The log
+ * is checked and cut off after its last complete record, but the
+ * buffers remain untouched until wal_replay(). Returns 0 on success,
+ * or -1 on errors.
+ */
+int
+wal_open(struct wal* self, const struct wal_config* config,
+         struct data_buf* buf, size_t nbufs);
+
+/* Restores the buffers `beg`, `beg + step`, and so on from the
+ * checkpoint and log. The checkpoint replaces all rows; without
+ * checkpoint, the log is replayed on top of the buffers' contents,
+ * such as zeroes or the rows of a store. Each processing thread
+ * replays its own buffers, so the rows are first touched on the
+ * thread's NUMA node. Returns 0 on success, or -1 on errors.
+ */
+int
+wal_replay(struct wal* self, size_t beg, size_t step);
+
+/* Writes a new checkpoint of the restored buffers and starts the
+ * flusher thread. Returns 0 on success, or -1 on errors. */
+int
+wal_start(struct wal* self);
+
+/* Stops the flusher thread, syncs all committed records and closes
+ * the log. Returns 0 on success, or -1 on errors. */
+int
+wal_close(struct wal* self);
+
+/* Writes a record for a row of `buf` into `rec`, which has room for
+ * at least WAL_MAX_RECORD_SIZE bytes. Returns the size of the record.
+ */
+size_t
+wal_put_record_tx(struct wal* self, uint8_t* rec, const struct data_buf* buf,
+                  size_t row, const uint8_t* data, size_t len);
+
+/* Appends records to the current segment. Has to be called within the
+ * transaction that applies the records, and between
+ * `data_buf_begin_write()` and `data_buf_end_write()`. */
+void
+wal_append_tx(struct wal* self, const uint8_t* recs, size_t len);
+
+/* Reports `len` bytes of records from a committed transaction to the
+ * flusher and waits until they have been synced. Returns 0 on success,
+ * or -1 if syncing the log failed. */
+int
+wal_commit(struct wal* self, size_t len);
+
+/* Syncs all committed records. Returns 0 on success, or -1 on errors. */
+int
+wal_sync(struct wal* self);
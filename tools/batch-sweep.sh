@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# picotm-demo - A demo application for picotm
+# Copyright (c) 2017-2018   Thomas Zimmermann <contact@tzimmermann.org>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+
+# Measures the input throughput of picotm-demo for several batch sizes.
+#
+#   tools/batch-sweep.sh [SIZES] [-- OPTIONS]
+#
+# SIZES is a space-separated list of batch sizes (default: 1 2 4 8 16
+# 32 64 128 256). Each size runs picotm-demo in headless mode for
+# --duration=5, unless OPTIONS set another end condition. OPTIONS are
+# passed on to picotm-demo. Set PICOTM_DEMO to the program's path if it
+# isn't src/picotm-demo.
+
+# Fail immediately on errors
+set -e
+
+PICOTM_DEMO=${PICOTM_DEMO:-src/picotm-demo}
+
+sizes=""
+while test $# -gt 0; do
+    if test "$1" = "--"; then
+        shift
+        break
+    fi
+    sizes="$sizes $1"
+    shift
+done
+sizes=${sizes:-1 2 4 8 16 32 64 128 256}
+
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+printf '%10s %14s %14s %10s\n' "batch size" "read msgs/s" "applied msgs/s" "aborts"
+
+for size in $sizes; do
+    "$PICOTM_DEMO" --duration=5 "$@" --batch-size="$size" > "$out" 2>&1 || {
+        cat "$out" >&2
+        exit 1
+    }
+    # Messages read:      309231 (306999 msgs/s, 38.49 MiB/s)
+    read=$(sed -n 's/^Messages read: *[0-9]* (\([0-9]*\) msgs\/s.*/\1/p' "$out")
+    applied=$(sed -n 's/^Messages applied: *[0-9]* (\([0-9]*\) msgs\/s.*/\1/p' "$out")
+    aborts=$(sed -n 's/^Input commits: *[0-9]* (\([0-9]*\) aborts.*/\1/p' "$out")
+    printf '%10s %14s %14s %10s\n' "$size" "$read" "$applied" "$aborts"
+done
+
+exit 0
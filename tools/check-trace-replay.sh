@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# picotm-demo - A demo application for picotm
+# Copyright (c) 2017-2018   Thomas Zimmermann <contact@tzimmermann.org>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+
+# Checks that replaying a trace reproduces the recorded messages.
+#
+#   tools/check-trace-replay.sh [-- OPTIONS]
+#
+# The script records a trace of 1 MiB of random input, then replays
+# the trace, with and without --mmap, while recording it again. Each
+# new trace has to be byte-for-byte identical to the original one.
+# OPTIONS are passed on to each run of picotm-demo. Set PICOTM_DEMO to
+# the program's path if it isn't src/picotm-demo.
+
+# Fail immediately on errors
+set -e
+
+PICOTM_DEMO=${PICOTM_DEMO:-src/picotm-demo}
+
+if test "$1" = "--"; then
+    shift
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+head -c 1048576 /dev/urandom > "$dir/input"
+
+run() {
+    "$PICOTM_DEMO" --headless "$@" > "$dir/out" 2>&1 || {
+        cat "$dir/out" >&2
+        exit 1
+    }
+}
+
+run --input="$dir/input" --record="$dir/trace" "$@"
+
+status=0
+
+for mmap in no yes; do
+    if test "$mmap" = "yes"; then
+        run --replay="$dir/trace" --mmap --record="$dir/replayed" "$@"
+    else
+        run --replay="$dir/trace" --record="$dir/replayed" "$@"
+    fi
+    if cmp -s "$dir/trace" "$dir/replayed"; then
+        echo "replay (mmap: $mmap): identical"
+    else
+        echo "replay (mmap: $mmap): traces differ"
+        status=1
+    fi
+done
+
+exit $status
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# picotm-demo - A demo application for picotm
+# Copyright (c) 2017-2018   Thomas Zimmermann <contact@tzimmermann.org>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+
+# Measures the throughput of picotm-demo with and without work stealing
+# on a skewed workload.
+#
+#   tools/steal-bench.sh [-- OPTIONS]
+#
+# Each run generates messages in headless mode for --duration=5. Nine
+# of ten messages go to the first of 16 queues, which 4 processing
+# threads serve. OPTIONS are passed on to picotm-demo and override
+# these defaults. Set PICOTM_DEMO to the program's path if it isn't
+# src/picotm-demo. Stealing only pays off if the processing threads
+# run on separate CPUs.
+
+# Fail immediately on errors
+set -e
+
+PICOTM_DEMO=${PICOTM_DEMO:-src/picotm-demo}
+
+if test "$1" = "--"; then
+    shift
+fi
+
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+printf '%8s %14s %14s %10s\n' "steal" "read msgs/s" "applied msgs/s" "stolen"
+
+for steal in no yes; do
+    if test "$steal" = "yes"; then
+        set -- --steal "$@"
+    fi
+    "$PICOTM_DEMO" --headless --duration=5 --queues=16 --proc-threads=4 \
+        --generate=queue=hot:0.0625:0.9 "$@" > "$out" 2>&1 || {
+        cat "$out" >&2
+        exit 1
+    }
+    # Messages read:      309231 (306999 msgs/s, 38.49 MiB/s)
+    read=$(sed -n 's/^Messages read: *[0-9]* (\([0-9]*\) msgs\/s.*/\1/p' "$out")
+    applied=$(sed -n 's/^Messages applied: *[0-9]* (\([0-9]*\) msgs\/s.*/\1/p' "$out")
+    stolen=$(sed -n 's/^Messages stolen: *\([0-9]*\).*/\1/p' "$out")
+    printf '%8s %14s %14s %10s\n' "$steal" "$read" "$applied" "${stolen:-0}"
+done
+
+exit 0